@@ -0,0 +1,268 @@
+// An event-driven stochastic simulation engine using Gillespie's direct method (the
+// Stochastic Simulation Algorithm, SSA) with the rates of the events held in a
+// MutableCategoricalArray.
+//
+// The state of the simulation is held by a MODEL, which must provide
+//
+//     double rate(int event) const;   // the current rate of event, given the state
+//     void fire(int event);           // applies event to the state
+//
+// for events 0...N-1. The engine is also given an EventDependencyGraph, which lists, for each
+// event, the events whose rates may change when it fires (usually including itself). step()
+// then chooses the next event in proportion to its rate in O(log(N)) time, advances time() by
+// an Exp(sum of rates) waiting time, fires the event and recalculates the rates of only its
+// dependents, which are updated in a single setMany(). run() steps until a given time.
+//
+// leap() takes a tau-leaping step, firing a Poisson number of each event over a fixed time
+// interval with the rates held constant, then updates the rates of the dependents of all the
+// events that fired, so many events can be fired per update.
+//
+// Each event fired is passed, with the time it fired, to a RECORDER, which defaults to
+// NoTrajectory, which records nothing and costs nothing. TrajectoryRecorder keeps the events
+// in a buffer, which can optionally be streamed to a sink whenever it fills.
+//
+// The rate tree is an ARRAY, which defaults to MutableCategoricalArray<double>. Floating point
+// sums drift a little as rates are modified, so the tree can be left with a tiny positive sum
+// when every rate is zero, or a draw can land on an event whose rate is zero. So an event is
+// only fired if both the tree and the model give it a positive rate. Otherwise it is redrawn
+// and, after maxConsecutiveRedraws failed draws, resetRates() rebuilds the tree from the model
+// before a last attempt. Integer (e.g. fixed-point) rates don't drift.
+#ifndef CPP_GILLESPIESIMULATION_H
+#define CPP_GILLESPIESIMULATION_H
+
+#include <cassert>
+#include <functional>
+#include <ostream>
+#include <random>
+#include <utility>
+#include <vector>
+#include "MutableCategoricalArray.h"
+
+// The events whose rates need recalculating when each event fires, stored in
+// compressed sparse row form.
+class EventDependencyGraph {
+public:
+    EventDependencyGraph() : offsets{0} { }
+
+    // dependents[i] lists the events whose rates may change when event i fires
+    explicit EventDependencyGraph(const std::vector<std::vector<int>> &dependents) : offsets{0} {
+        for(const std::vector<int> &eventDependents: dependents) addEvent(eventDependents.begin(), eventDependents.end());
+    }
+
+    // adds the next event, whose dependents are given by the range [begin, end)
+    template<typename ITERATOR>
+    void addEvent(ITERATOR begin, ITERATOR end) {
+        targets.insert(targets.end(), begin, end);
+        offsets.push_back(targets.size());
+    }
+
+    int nEvents() const { return offsets.size() - 1; }
+
+    const int *begin(int event) const { return targets.data() + offsets[event]; }
+    const int *end(int event) const { return targets.data() + offsets[event + 1]; }
+
+protected:
+    std::vector<size_t> offsets;    // dependents of event i are targets[offsets[i]...offsets[i+1]-1]
+    std::vector<int>    targets;
+};
+
+
+// The default RECORDER, which records nothing
+class NoTrajectory {
+public:
+    void record(double /*time*/, int /*event*/) { }
+};
+
+
+// A RECORDER that appends each (time, event) to a buffer. With no sink, the buffer holds the
+// whole trajectory. Given a sink, the buffer is passed to the sink and cleared whenever it
+// holds bufferSize records, and on flush() or destruction, so a long trajectory can be streamed
+// (e.g. to a file with writeTo()) in constant memory.
+class TrajectoryRecorder {
+public:
+    struct Record {
+        double  time;
+        int     event;
+    };
+
+    typedef std::function<void(const std::vector<Record> &)> sink_type;
+
+    TrajectoryRecorder() = default;
+
+    TrajectoryRecorder(size_t bufferSize, sink_type sink) : bufferSize(bufferSize), sink(std::move(sink)) {
+        buffer.reserve(bufferSize);
+    }
+
+    TrajectoryRecorder(TrajectoryRecorder &&other) = default;
+    TrajectoryRecorder(const TrajectoryRecorder &other) = delete; // a copy would send the buffer to the sink twice
+
+    ~TrajectoryRecorder() { flush(); }
+
+    void record(double time, int event) {
+        buffer.push_back({time, event});
+        if(sink && buffer.size() >= bufferSize) flush();
+    }
+
+    void flush() {
+        if(sink && !buffer.empty()) {
+            sink(buffer);
+            buffer.clear();
+        }
+    }
+
+    // the records not yet passed to the sink (or all records, if there's no sink)
+    const std::vector<Record> &records() const { return buffer; }
+
+    // a sink that writes each record as a line "time event" to out
+    static sink_type writeTo(std::ostream &out) {
+        return [&out](const std::vector<Record> &records) {
+            for(const Record &record: records) out << record.time << " " << record.event << "\n";
+        };
+    }
+
+protected:
+    size_t              bufferSize = 0;
+    sink_type           sink;
+    std::vector<Record> buffer;
+};
+
+
+template<class MODEL, class ARRAY = MutableCategoricalArray<double>, class RECORDER = NoTrajectory>
+class GillespieSimulation: protected RECORDER {
+public:
+    GillespieSimulation(MODEL &model, EventDependencyGraph dependencies, double startTime = 0.0, RECORDER recorder = RECORDER()) :
+        RECORDER(std::move(recorder)),
+        model(model),
+        dependencies(std::move(dependencies)),
+        rateTree(this->dependencies.nEvents(), [&model](int event) { return model.rate(event); }),
+        currentTime(startTime),
+        nFired(0),
+        leapNumber(0),
+        lastLeapUpdated(this->dependencies.nEvents(), 0) { }
+
+    // Fires the next event and advances time() to when it fires. Returns the event, or -1
+    // (leaving time() unchanged) if all rates are zero.
+    template<typename RNG>
+    int step(RNG &generator) {
+        int event = nextEvent(generator);
+        if(event == -1) return -1;
+        currentTime += std::exponential_distribution<double>(rateTree.sum())(generator);
+        fire(event);
+        return event;
+    }
+
+    // Fires events until the next would be after endTime, then advances time() to endTime
+    // (since waiting times are memoryless, the draws that overshoot can be discarded).
+    // Returns the number of events fired.
+    template<typename RNG>
+    long run(RNG &generator, double endTime) {
+        long nFiredBefore = nFired;
+        int event;
+        while((event = nextEvent(generator)) != -1) {
+            double nextTime = currentTime + std::exponential_distribution<double>(rateTree.sum())(generator);
+            if(nextTime > endTime) break;
+            currentTime = nextTime;
+            fire(event);
+        }
+        if(endTime > currentTime) currentTime = endTime;
+        return nFired - nFiredBefore;
+    }
+
+    // Tau-leaping: advances time() by tau, firing each event a Poisson(rate * tau) number of
+    // times with the rates held at their values at the start of the leap, then recalculates the
+    // rates of the dependents of all the events fired in a single setMany(). Rather than draw
+    // N Poisson counts, we draw the total K ~ Poisson(sum() * tau) then K events from the rate
+    // tree, which gives the same independent Poisson counts in O(K log(N)) time. Events are
+    // fired in random order and recorded at the end of the leap. The caller should choose tau
+    // small enough that rates change little over a leap and the state stays valid (e.g.
+    // populations don't go negative). Returns the number of events fired.
+    template<typename RNG>
+    long leap(RNG &generator, double tau) {
+        double totalRate = rateTree.sum();
+        long nEvents = totalRate > 0.0 ? std::poisson_distribution<long>(totalRate * tau)(generator) : 0;
+        leapEvents.resize(nEvents);
+        rateTree.sample(generator, nEvents, leapEvents.begin());
+        currentTime += tau;
+        ++leapNumber;
+        updates.clear();
+        for(int event: leapEvents) {
+            model.fire(event);
+            this->record(currentTime, event);
+            for(const int *dependent = dependencies.begin(event); dependent != dependencies.end(event); ++dependent) {
+                if(lastLeapUpdated[*dependent] != leapNumber) {
+                    lastLeapUpdated[*dependent] = leapNumber;
+                    updates.emplace_back(*dependent, 0.0);
+                }
+            }
+        }
+        for(std::pair<int,double> &update: updates) update.second = model.rate(update.first);
+        rateTree.setMany(updates.begin(), updates.end());
+        nFired += nEvents;
+        return nEvents;
+    }
+
+    // Recalculates the rates of the given events, for when the state is changed other than by
+    // firing events
+    template<typename ITERATOR>
+    void updateRates(ITERATOR beginEvents, ITERATOR endEvents) {
+        updates.clear();
+        for(ITERATOR event = beginEvents; event != endEvents; ++event) updates.emplace_back(*event, model.rate(*event));
+        rateTree.setMany(updates.begin(), updates.end());
+    }
+
+    // Recalculates all rates, in O(N) time, clearing any accumulated rounding error
+    void resetRates() {
+        std::vector<double> allRates(nEvents());
+        for(int event = 0; event < nEvents(); ++event) allRates[event] = model.rate(event);
+        rateTree.setAll(allRates);
+    }
+
+    double time() const { return currentTime; }
+    void setTime(double time) { currentTime = time; }
+    long nEventsFired() const { return nFired; }
+    int nEvents() const { return rateTree.size(); }
+    double totalRate() const { return rateTree.sum(); }
+    const ARRAY &rates() const { return rateTree; }
+    RECORDER &recorder() { return *this; }
+    const RECORDER &recorder() const { return *this; }
+
+protected:
+    static constexpr int maxConsecutiveRedraws = 64;
+
+    // Draws the next event in proportion to its rate, or returns -1 if no event has a positive
+    // rate. The event's rate in the tree can be rounding residue, so the model's rate is checked too.
+    template<typename RNG>
+    int nextEvent(RNG &generator) {
+        for(int nResets = 0; nResets < 2 && rateTree.sum() > 0.0; ++nResets) {
+            for(int nRedraws = 0; nRedraws < maxConsecutiveRedraws; ++nRedraws) {
+                int event = rateTree(generator);
+                if(rateTree[event] > 0.0 && model.rate(event) > 0.0) return event;
+            }
+            if(nResets == 0) resetRates();
+        }
+        return -1;
+    }
+
+    void fire(int event) {
+        model.fire(event);
+        this->record(currentTime, event);
+        ++nFired;
+        updates.clear();
+        for(const int *dependent = dependencies.begin(event); dependent != dependencies.end(event); ++dependent) {
+            updates.emplace_back(*dependent, model.rate(*dependent));
+        }
+        rateTree.setMany(updates.begin(), updates.end());
+    }
+
+    MODEL &                             model;
+    EventDependencyGraph                dependencies;
+    ARRAY                               rateTree;
+    double                              currentTime;
+    long                                nFired;
+    std::vector<std::pair<int,double>>  updates;            // (event, new rate) buffer for setMany()
+    std::vector<int>                    leapEvents;         // events drawn in a leap
+    long                                leapNumber;
+    std::vector<long>                   lastLeapUpdated;    // the last leap in which each event's rate was queued for update
+};
+
+#endif //CPP_GILLESPIESIMULATION_H
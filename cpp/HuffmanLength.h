@@ -0,0 +1,30 @@
+//
+// Calculates the expected depth of a sample from the optimal (Huffman) sum tree of
+// a set of weights, in O(N log(N)) time.
+//
+
+#ifndef CPP_HUFFMANLENGTH_H
+#define CPP_HUFFMANLENGTH_H
+
+#include <queue>
+#include <vector>
+#include <functional>
+
+template<class ITERATOR>
+double calcHuffmanLength(ITERATOR beginWeights, ITERATOR endWeights) {
+    std::priority_queue<double, std::vector<double>, std::greater<double>> heap(beginWeights, endWeights);
+    if(heap.empty()) return 0.0;
+    double totalLength = 0.0;
+    while(heap.size() > 1) {
+        double first = heap.top();
+        heap.pop();
+        double second = heap.top();
+        heap.pop();
+        double sum = first + second;
+        totalLength += sum;
+        heap.push(sum);
+    }
+    return totalLength / heap.top();
+}
+
+#endif //CPP_HUFFMANLENGTH_H
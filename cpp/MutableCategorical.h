@@ -10,157 +10,432 @@
 // The list [C_0...C_N] need not consist of unique objects (i.e. it is possible that C_i == C_j
 // for some i \ne j).
 //
-// The underlying storage is a MutableCategoricalArray, along with another array
-// that maps the integer range [0...N] to {C_0...C_N}.
+// The underlying storage is a MutableCategoricalArray, along with a contiguous array of
+// the objects {C_0...C_N} in the same order as their indices in the MutableCategoricalArray.
+// The type of the weights, WEIGHT, is passed on to the MutableCategoricalArray. When a category
+// is erased, the last category is moved into its place, so adding and erasing don't allocate
+// memory (other than to grow the arrays) and a sample is just a lookup in the arrays.
+//
+// Since categories move when others are erased, categories are identified by iterators that
+// hold a slot number, which is a stable handle to a category until it is erased. Each slot
+// holds the current index of its category and a generation count that is incremented when
+// its category is erased, so a stale iterator can be detected using isValid() even if its
+// slot has since been reused. The slot and generation of each index are also held alongside
+// each other in indexToSlot, and an iterator remembers the index it was created at, so a draw
+// followed by a dereference reads only indexToSlot and the labels: the slot's index is only
+// read if the category has moved since the iterator was created.
+//
+// If HASH is not void, the distribution also keeps an index from label to slot, in an
+// open-addressing hash table with linear probing, so categories can be looked up, modified and
+// erased by label using set(label, weight), weight(label), erase(label), contains(label) and
+// find(label) in O(1) expected time (plus O(log N) to update the weight). Since the table
+// holds slots, which don't move when categories are erased, it doesn't need updating when
+// a category is moved into an erased position. In this case labels must be unique.
+//
+// The INSTRUMENTATION policy is passed on to the MutableCategoricalArray, so stats() counts
+// draws and updates of the array, including those made by add() and erase().
+// MutableCategoricalWithIndex<T> is an alias for a MutableCategorical indexed by std::hash<T>.
 #ifndef CPP_MUTABLECATEGORICAL_H
 #define CPP_MUTABLECATEGORICAL_H
 
-#include <list>
+#include <vector>
+#include <iterator>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <cassert>
 #include "MutableCategoricalArray.h"
 
-template<class T>
+template<class T, class WEIGHT = double, class HASH = void, class INSTRUMENTATION = NoInstrumentation>
 class MutableCategorical {
 protected:
 
-    class Category {
+    class Slot {
     public:
-        T value;
-
-        operator const T &() const { return value; }
-        operator T &() & { return value; }
-        operator T &&() && { return std::move(value); }
-
-        Category(const T &v, int index) : value(v), index(index) {}
-        Category(T &&v, int index) : value(std::move(v)), index(index) {}
-        template<class...ARGS>
-        explicit Category(int index, ARGS&&... args): value(std::forward<ARGS>(args)...), index(index) { }
+        int             index;          // index of the category, or the next free slot if this slot is free
+        unsigned int    generation;     // number of times this slot has been freed
+    };
 
-        int index;
+    // the slot of the category at an index, and the slot's generation
+    class SlotRef {
+    public:
+        int             slot;
+        unsigned int    generation;
     };
 
 
-    template<class V>
+    template<class DIST, class V>
     class iterator_base {
     public:
 
-        iterator_base(V ptr): ptr(ptr) {}
+        iterator_base(): distribution(nullptr), slot(-1), generation(0), cachedIndex(-1) { }
+        iterator_base(DIST *distribution, int slot): distribution(distribution), slot(slot),
+            generation(slot < 0 ? 0 : distribution->slots[slot].generation), cachedIndex(-1) { }
 
-        auto &operator *()  { return ptr->value; }
-        auto *operator ->() { return &ptr->value; }
-        iterator_base<V> &operator ++() { ++ptr; return *this; }
-        iterator_base<V> operator ++(int) { return ptr++; }
-        bool operator ==(const iterator_base<V> &other) const { return ptr == other.ptr; }
-        bool operator !=(const iterator_base<V> &other) const { return ptr != other.ptr; }
-        operator iterator_base<typename std::list<Category>::const_iterator>() { return iterator_base<typename std::list<Category>::const_iterator>(ptr); }
+        V &operator *() const { return distribution->labels[index()]; }
+        V *operator ->() const { return &distribution->labels[index()]; }
+        iterator_base<DIST,V> &operator ++() { *this = distribution->iteratorAt(index() + 1); return *this; }
+        iterator_base<DIST,V> operator ++(int) { iterator_base<DIST,V> preIncrementVal = *this; ++(*this); return preIncrementVal; }
+        bool operator ==(const iterator_base<DIST,V> &other) const { return slot == other.slot && generation == other.generation; }
+        bool operator !=(const iterator_base<DIST,V> &other) const { return !(*this == other); }
+        operator iterator_base<const DIST, const V>() const { return iterator_base<const DIST, const V>(distribution, slot, generation, cachedIndex); }
 
     protected:
-        V ptr;
-        auto &index() { return ptr->index; }
-        friend class MutableCategorical<T>;
+        DIST *          distribution;
+        int             slot;           // -1 for end()
+        unsigned int    generation;
+        mutable int     cachedIndex;    // the index of the category when last looked up, or -1
+
+        iterator_base(DIST *distribution, int slot, unsigned int generation, int cachedIndex):
+            distribution(distribution), slot(slot), generation(generation), cachedIndex(cachedIndex) { }
+
+        bool isValid() const { return slot >= 0 && distribution->slots[slot].generation == generation; }
+
+        // if indexToSlot still refers to this iterator at cachedIndex, the category hasn't moved
+        int index() const {
+            if(cachedIndex >= 0 && cachedIndex < static_cast<int>(distribution->indexToSlot.size())) {
+                const SlotRef &ref = distribution->indexToSlot[cachedIndex];
+                if(ref.slot == slot && ref.generation == generation) return cachedIndex;
+            }
+            assert(isValid());
+            cachedIndex = distribution->slots[slot].index;
+            return cachedIndex;
+        }
+        friend class MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>;
+        template<class D, class W> friend class iterator_base;
     };
 
 
 public:
+    static constexpr bool INDEXED = !std::is_void<HASH>::value;
+
     typedef T value_type;
-    typedef iterator_base<typename std::list<Category>::iterator>        iterator;
-    typedef iterator_base<typename std::list<Category>::const_iterator>  const_iterator;
+    typedef iterator_base<MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>, T>                iterator;
+    typedef iterator_base<const MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>, const T>    const_iterator;
 
-    MutableCategoricalArray mca;
-    std::vector<iterator>   indexToCategory;
-    std::list<Category>     categories;
+    typedef MutableCategoricalArray<WEIGHT, std::vector<WEIGHT>, INSTRUMENTATION> array_type;
 
+    array_type mca;
 
-    MutableCategorical() {}
+    MutableCategorical(): firstFreeSlot(-1) {}
 
-    MutableCategorical(int size, std::function<std::pair<T,double>(int)> init) {
-        mca.reserve(size);
-        indexToCategory.reserve(size);
-        for(int i=size-1; i>=0; --i) {
-            std::pair<T,double> v = init(i);
-            add(std::move(v.first), v.second);
+    MutableCategorical(int size, std::function<std::pair<T,WEIGHT>(int)> init): firstFreeSlot(-1) {
+        std::vector<WEIGHT> weights;
+        reserve(size);
+        weights.reserve(size);
+        for(int i=0; i<size; ++i) {
+            std::pair<T,WEIGHT> v = init(i);
+            labels.push_back(std::move(v.first));
+            weights.push_back(v.second);
+            slots.push_back(Slot{i, 0});
+            indexToSlot.push_back(SlotRef{i, 0});
         }
+        mca = array_type(weights.begin(), weights.end());
+        if constexpr (INDEXED) rehash(2 * size);
     }
 
 
-    iterator add(const T &categoryLabel, double weight);
-    iterator add(T &&categoryLabel, double weight);
-    template<class... ARGS> iterator emplace(double weight, ARGS&&... args);
-    iterator erase(iterator category);
-    void set(iterator category, double weight);
-    double weight(const_iterator category) const { return mca[category.index()]; }
-    double probability(const_iterator category) const { return weight(category)/sum(); }
-    double sum() const { return mca.sum(); }
-    iterator begin() { return categories.begin(); }
-    iterator end()   { return categories.end(); }
-    const_iterator begin() const { return categories.begin(); }
-    const_iterator end()   const { return categories.end(); }
-    size_t size() const { return indexToCategory.size(); }
-    void reserve(size_t size) { indexToCategory.reserve(size); mca.reserve(size); }
+    iterator add(const T &categoryLabel, WEIGHT weight);
+    iterator add(T &&categoryLabel, WEIGHT weight);
+    template<class... ARGS> iterator emplace(WEIGHT weight, ARGS&&... args);
+    iterator erase(const_iterator category);
+    void set(const_iterator category, WEIGHT weight) { mca.set(category.index(), weight); }
+    WEIGHT weight(const_iterator category) const { return mca[category.index()]; }
+    double probability(const_iterator category) const { return static_cast<double>(weight(category))/sum(); }
+    WEIGHT sum() const { return mca.sum(); }
+    // true if the category has not been erased
+    bool isValid(const_iterator category) const { return category.isValid(); }
+
+    // Lookup by label, only available if HASH is not void.
+    // set(label, weight) adds the label if it isn't already present.
+    iterator find(const T &label) { return iterator(this, findSlot(label)); }
+    const_iterator find(const T &label) const { return const_iterator(this, findSlot(label)); }
+    bool contains(const T &label) const { return findSlot(label) != -1; }
+    void set(const T &label, WEIGHT weight);
+    WEIGHT weight(const T &label) const;
+    size_t erase(const T &label);
+    iterator begin() { return iteratorAt(0); }
+    iterator end()   { return iterator(this, -1); }
+    const_iterator begin() const { return iteratorAt(0); }
+    const_iterator end()   const { return const_iterator(this, -1); }
+    size_t size() const { return labels.size(); }
+
+    // the stats of the underlying array, with the memory footprint of all storage
+    MutableCategoricalStats stats() const {
+        MutableCategoricalStats stats = mca.stats();
+        stats.memoryBytes += sizeof(*this) - sizeof(mca)
+                + labels.capacity() * sizeof(T)
+                + indexToSlot.capacity() * sizeof(SlotRef)
+                + slots.capacity() * sizeof(Slot)
+                + slotTable.capacity() * sizeof(int);
+        return stats;
+    }
+    void reserve(size_t size) { labels.reserve(size); indexToSlot.reserve(size); slots.reserve(size); mca.reserve(size); }
     template<class RNG> iterator operator()(RNG &randomGenerator) {
-        if(size() == 0) return categories.end();
-        return indexToCategory[mca(randomGenerator)];
+        if(size() == 0) return end();
+        return iteratorAt(mca(randomGenerator));
     }
     template<class RNG> const_iterator operator()(RNG &randomGenerator) const {
-        if(size() == 0) return categories.end();
-        return indexToCategory[mca(randomGenerator)];
+        if(size() == 0) return end();
+        return iteratorAt(mca(randomGenerator));
+    }
+
+    // Draws up to k distinct categories without replacement, writing iterators to them to out
+    // in order of drawing (see MutableCategoricalArray::sampleDistinct())
+    template<class RNG, class OUTPUTITERATOR>
+    OUTPUTITERATOR sampleDistinct(RNG &randomGenerator, size_t k, OUTPUTITERATOR out) {
+        std::vector<int> indices;
+        mca.sampleDistinct(randomGenerator, k, std::back_inserter(indices));
+        for(int index: indices) *out++ = iteratorAt(index);
+        return out;
+    }
+    template<class RNG, class OUTPUTITERATOR>
+    OUTPUTITERATOR sampleDistinct(RNG &randomGenerator, size_t k, OUTPUTITERATOR out) const {
+        std::vector<int> indices;
+        mca.sampleDistinct(randomGenerator, k, std::back_inserter(indices));
+        for(int index: indices) *out++ = iteratorAt(index);
+        return out;
     }
 
+    // Draws a category as if excluded had zero weight, without modifying the distribution,
+    // or returns end() if no other category has weight (see MutableCategoricalArray::sampleExcluding())
+    template<class RNG> iterator sampleExcluding(RNG &randomGenerator, const_iterator excluded) {
+        int index = mca.sampleExcluding(randomGenerator, excluded.index());
+        return index == -1 ? end() : iteratorAt(index);
+    }
+    template<class RNG> const_iterator sampleExcluding(RNG &randomGenerator, const_iterator excluded) const {
+        int index = mca.sampleExcluding(randomGenerator, excluded.index());
+        return index == -1 ? end() : iteratorAt(index);
+    }
 
-    friend std::ostream &operator <<(std::ostream &out, const MutableCategorical<T> &distribution) {
+    // The inverse of the cumulative distribution, in order of iteration, given a cumulative
+    // weight in [0, sum()) or a u in [0,1) (see MutableCategoricalArray::findByCumulative() and quantile())
+    iterator findByCumulative(WEIGHT cumulativeWeight) { return size() == 0 ? end() : iteratorAt(mca.findByCumulative(cumulativeWeight)); }
+    const_iterator findByCumulative(WEIGHT cumulativeWeight) const { return size() == 0 ? end() : iteratorAt(mca.findByCumulative(cumulativeWeight)); }
+    iterator quantile(double u) { return size() == 0 ? end() : iteratorAt(mca.quantile(u)); }
+    const_iterator quantile(double u) const { return size() == 0 ? end() : iteratorAt(mca.quantile(u)); }
+
+    // the sum of the weights of the categories before this one in order of iteration
+    WEIGHT prefixSum(const_iterator category) const { return mca.prefixSum(category.index()); }
+
+    // writes quantile(u) to out for each u in the sorted range [begin, end), in one traversal of the tree
+    template<class RANDOMACCESSITERATOR, class OUTPUTITERATOR>
+    OUTPUTITERATOR quantiles(RANDOMACCESSITERATOR begin, RANDOMACCESSITERATOR end, OUTPUTITERATOR out) {
+        std::vector<int> indices;
+        mca.quantiles(begin, end, std::back_inserter(indices));
+        for(int index: indices) *out++ = iteratorAt(index);
+        return out;
+    }
+    template<class RANDOMACCESSITERATOR, class OUTPUTITERATOR>
+    OUTPUTITERATOR quantiles(RANDOMACCESSITERATOR begin, RANDOMACCESSITERATOR end, OUTPUTITERATOR out) const {
+        std::vector<int> indices;
+        mca.quantiles(begin, end, std::back_inserter(indices));
+        for(int index: indices) *out++ = iteratorAt(index);
+        return out;
+    }
+
+
+    friend std::ostream &operator <<(std::ostream &out, const MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION> &distribution) {
         for(int i=0; i<distribution.size(); ++i) {
-            out << distribution.categoryLabels[i] << " -> " << distribution.mca[i] << std::endl;
+            out << distribution.labels[i] << " -> " << distribution.mca[i] << std::endl;
         }
         return out;
     }
+
+protected:
+    std::vector<T>      labels;         // labels[i] is the category with index i in mca
+    std::vector<SlotRef> indexToSlot;   // indexToSlot[i] is the slot of the category with index i
+    std::vector<Slot>   slots;
+    int                 firstFreeSlot;  // head of the linked list of free slots, or -1
+
+    iterator iteratorAt(int index) {
+        if(index >= static_cast<int>(size())) return end();
+        return iterator(this, indexToSlot[index].slot, indexToSlot[index].generation, index);
+    }
+    const_iterator iteratorAt(int index) const {
+        if(index >= static_cast<int>(size())) return end();
+        return const_iterator(this, indexToSlot[index].slot, indexToSlot[index].generation, index);
+    }
+
+    // open addressing hash table from label to slot, used only if INDEXED.
+    // Entries are slots, or -1 if empty. The size is a power of two and at most half full.
+    std::vector<int>    slotTable;
+    int                 slotTableBits = 0;
+
+    // adds a slot for a new category at index size() (before its label is added)
+    int newSlot();
+
+    // the slot of the category with the given label, or -1 if not present
+    int findSlot(const T &label) const;
+
+    // the preferred table entry for a label, from the top bits of its (Fibonacci scrambled) hash
+    int homeEntry(const T &label) const {
+        return static_cast<int>((static_cast<uint64_t>(HASH()(label)) * 0x9E3779B97F4A7C15ull) >> (64 - slotTableBits));
+    }
+
+    // adds the slot of the category just added at index size()-1 to the table
+    void insertInTable(int slot);
+    void removeFromTable(int slot);
+    void rehash(size_t minSize);
 };
 
-// invalidates the erased iterator.
-// returns an iterator to the element after the erased element.
-template<class T>
-typename MutableCategorical<T>::iterator MutableCategorical<T>::erase(iterator category) {
+template<class T, class WEIGHT = double, class HASH = std::hash<T>>
+using MutableCategoricalWithIndex = MutableCategorical<T,WEIGHT,HASH>;
+
+// Erases a category by moving the last category into its place, so invalidates only
+// the erased iterator. Returns an iterator to the category that has taken the place of
+// the erased category (i.e. the next category when iterating), or end() if there is none.
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+typename MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::iterator MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::erase(const_iterator category) {
     int categoryIndexToErase = category.index();
+    if constexpr (INDEXED) removeFromTable(category.slot);
     int lastCategoryIndex = size() - 1;
     if(categoryIndexToErase != lastCategoryIndex) {
         mca.set(categoryIndexToErase, mca[lastCategoryIndex]);
-        iterator categoryToReindex = indexToCategory[lastCategoryIndex];
-        indexToCategory[categoryIndexToErase] = categoryToReindex;
-        categoryToReindex.index() = categoryIndexToErase;
+        labels[categoryIndexToErase] = std::move(labels[lastCategoryIndex]);
+        SlotRef movedRef = indexToSlot[lastCategoryIndex];
+        indexToSlot[categoryIndexToErase] = movedRef;
+        slots[movedRef.slot].index = categoryIndexToErase;
     }
     mca.pop_back();
-    indexToCategory.pop_back();
-    return categories.erase(category.ptr);
+    labels.pop_back();
+    indexToSlot.pop_back();
+    Slot &erasedSlot = slots[category.slot];
+    ++erasedSlot.generation;
+    erasedSlot.index = firstFreeSlot;
+    firstFreeSlot = category.slot;
+    return iteratorAt(categoryIndexToErase);
 }
 
-template<class T>
-typename MutableCategorical<T>::iterator MutableCategorical<T>::add(const T &categoryLabel, double weight) {
-    mca.push_back(weight);
-    categories.push_front(Category(categoryLabel, mca.size()-1));
-    indexToCategory.push_back(categories.begin());
-    return categories.begin();
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+int MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::newSlot() {
+    int slot = firstFreeSlot;
+    if(slot == -1) {
+        slot = slots.size();
+        slots.push_back(Slot{0, 0});
+    } else {
+        firstFreeSlot = slots[slot].index;
+    }
+    slots[slot].index = size();
+    indexToSlot.push_back(SlotRef{slot, slots[slot].generation});
+    return slot;
 }
 
-template<class T>
-typename MutableCategorical<T>::iterator MutableCategorical<T>::add(T &&categoryLabel, double weight) {
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+typename MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::iterator MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::add(const T &categoryLabel, WEIGHT weight) {
+    int slot = newSlot();
     mca.push_back(weight);
-    categories.push_front(Category(std::move(categoryLabel), mca.size()-1));
-    indexToCategory.push_back(categories.begin());
-    return categories.begin();
+    labels.push_back(categoryLabel);
+    if constexpr (INDEXED) insertInTable(slot);
+    return iterator(this, slot);
 }
 
-template<class T>
-void MutableCategorical<T>::set(iterator category, double weight) {
-    mca.set(category.index(), weight);
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+typename MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::iterator MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::add(T &&categoryLabel, WEIGHT weight) {
+    int slot = newSlot();
+    mca.push_back(weight);
+    labels.push_back(std::move(categoryLabel));
+    if constexpr (INDEXED) insertInTable(slot);
+    return iterator(this, slot);
 }
 
 
 // args should be the arguments to a constructor of T
-template<class T>
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
 template<class... ARGS>
-typename MutableCategorical<T>::iterator MutableCategorical<T>::emplace(double weight, ARGS &&... args) {
+typename MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::iterator MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::emplace(WEIGHT weight, ARGS &&... args) {
+    int slot = newSlot();
     mca.push_back(weight);
-    categories.emplace_front(mca.size()-1, std::forward<ARGS>(args)...);
-    indexToCategory.push_back(categories.begin());
-    return categories.begin();
+    labels.emplace_back(std::forward<ARGS>(args)...);
+    if constexpr (INDEXED) insertInTable(slot);
+    return iterator(this, slot);
+}
+
+
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+void MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::set(const T &label, WEIGHT weight) {
+    int slot = findSlot(label);
+    if(slot == -1) {
+        add(label, weight);
+    } else {
+        mca.set(slots[slot].index, weight);
+    }
+}
+
+// returns zero if the label isn't present
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+WEIGHT MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::weight(const T &label) const {
+    int slot = findSlot(label);
+    return slot == -1 ? WEIGHT(0) : mca[slots[slot].index];
+}
+
+// returns the number of categories erased (0 or 1)
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+size_t MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::erase(const T &label) {
+    int slot = findSlot(label);
+    if(slot == -1) return 0;
+    erase(const_iterator(this, slot));
+    return 1;
+}
+
+
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+int MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::findSlot(const T &label) const {
+    static_assert(INDEXED, "Lookup by label needs a MutableCategorical with a HASH");
+    if(slotTable.empty()) return -1;
+    int mask = slotTable.size() - 1;
+    for(int entry = homeEntry(label); slotTable[entry] != -1; entry = (entry + 1) & mask) {
+        int slot = slotTable[entry];
+        if(labels[slots[slot].index] == label) return slot;
+    }
+    return -1;
+}
+
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+void MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::insertInTable(int slot) {
+    if(2 * size() > slotTable.size()) {
+        rehash(2 * size());
+        return;
+    }
+    int mask = slotTable.size() - 1;
+    int entry = homeEntry(labels[slots[slot].index]);
+    while(slotTable[entry] != -1) {
+        assert(!(labels[slots[slotTable[entry]].index] == labels[slots[slot].index])); // labels must be unique
+        entry = (entry + 1) & mask;
+    }
+    slotTable[entry] = slot;
+}
+
+// Removes a slot from the table by backward shift deletion, so there's no need for
+// tombstones: entries after the gap are moved into it unless that would put them
+// before their home entry.
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+void MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::removeFromTable(int slot) {
+    int mask = slotTable.size() - 1;
+    int gap = homeEntry(labels[slots[slot].index]);
+    while(slotTable[gap] != slot) gap = (gap + 1) & mask;
+    for(int entry = (gap + 1) & mask; slotTable[entry] != -1; entry = (entry + 1) & mask) {
+        int home = homeEntry(labels[slots[slotTable[entry]].index]);
+        if(((entry - home) & mask) >= ((entry - gap) & mask)) {
+            slotTable[gap] = slotTable[entry];
+            gap = entry;
+        }
+    }
+    slotTable[gap] = -1;
+}
+
+// rebuilds the table with at least minSize entries
+template<class T, class WEIGHT, class HASH, class INSTRUMENTATION>
+void MutableCategorical<T,WEIGHT,HASH,INSTRUMENTATION>::rehash(size_t minSize) {
+    slotTableBits = 4;
+    while((size_t(1) << slotTableBits) < minSize) ++slotTableBits;
+    slotTable.assign(size_t(1) << slotTableBits, -1);
+    int mask = slotTable.size() - 1;
+    for(size_t index = 0; index < indexToSlot.size(); ++index) {
+        int entry = homeEntry(labels[index]);
+        while(slotTable[entry] != -1) entry = (entry + 1) & mask;
+        slotTable[entry] = indexToSlot[index].slot;
+    }
 }
 
 
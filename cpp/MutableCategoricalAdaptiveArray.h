@@ -0,0 +1,212 @@
+// This class has the same interface as MutableCategoricalArray, but switches to sampling
+// from a Walker alias table, in O(1) time per draw, during phases where draws greatly
+// outnumber modifications.
+//
+// The weights are always held in a MutableCategoricalArray, so modifications take
+// O(log(N)) time as usual. The alias table is built, using Vose's method, in O(N) time
+// and any modification of the weights discards it, since there's no efficient
+// way of patching an alias table when a weight changes. Whether to build the table is
+// decided from the observed ratio of draws to modifications: once the number of draws since
+// the last modification would have cost as much, descending the tree, as building the table,
+// the table is built, so whatever the pattern of draws and modifications the total cost of
+// sampling is at most about twice the cost of the better of the two strategies. So, a workload
+// that modifies after every few draws never builds the table, while one that takes millions
+// of draws between bulk updates samples almost entirely from the table.
+//
+// Draws from the alias table have exactly the distribution given by the weights, to within
+// the rounding of the table entries to doubles, in the same way as draws from the tree.
+//
+// Note that operator() may build the table, so, unlike MutableCategoricalArray, it is not
+// safe to draw from the same distribution concurrently in more than one thread.
+#ifndef CPP_MUTABLECATEGORICALADAPTIVEARRAY_H
+#define CPP_MUTABLECATEGORICALADAPTIVEARRAY_H
+
+#include <vector>
+#include <random>
+#include <ostream>
+#include <cmath>
+#include "MutableCategoricalArray.h"
+
+template<class WEIGHT = double>
+class MutableCategoricalAdaptiveArray {
+
+    // This class allows array operator [] syntax for both reading and writing
+    class EntryRef {
+        int i;
+        MutableCategoricalAdaptiveArray &p;
+    public:
+
+        EntryRef(int index, MutableCategoricalAdaptiveArray &dist): i(index), p(dist) { }
+        operator WEIGHT() const { return p.get(i); }
+        WEIGHT weight() const { return p.get(i); }
+        WEIGHT operator =(WEIGHT weight) { p.set(i, weight); return weight; }
+        WEIGHT operator =(const EntryRef &otherRef) {   // reference assignment semantics
+            WEIGHT w_i = otherRef.weight();
+            p.set(i, w_i); return w_i; }
+    };
+
+    MutableCategoricalArray<WEIGHT> tree;
+
+    // The alias table: a draw chooses bucket i uniformly, then returns i with probability
+    // aliasThreshold[i] and alias[i] otherwise. Empty if there's no valid table.
+    mutable std::vector<double>     aliasThreshold;
+    mutable std::vector<int>        alias;
+    // number of draws before the tree descents cost as much as building the table
+    mutable double                  nDrawsBeforeAliasTable;
+
+public:
+    // Relative cost per category of building the alias table compared to one step of a
+    // tree descent, found by benchmarking
+    static constexpr double aliasBuildCost = 4.0;
+
+    MutableCategoricalAdaptiveArray() { modified(); }
+    MutableCategoricalAdaptiveArray(int size): tree(size) { modified(); }
+    MutableCategoricalAdaptiveArray(int size, std::function<WEIGHT(int)> init): tree(size, init) { modified(); }
+    MutableCategoricalAdaptiveArray(std::initializer_list<WEIGHT> values): tree(values) { modified(); }
+
+    template<typename ITERATOR,
+            typename std::enable_if<
+                    std::is_convertible<
+                            typename std::iterator_traits<ITERATOR>::iterator_category,
+                            std::input_iterator_tag
+                    >::value, int
+            >::type = 0>
+    MutableCategoricalAdaptiveArray(ITERATOR begin, ITERATOR end): tree(begin, end) { modified(); }
+
+
+    size_t size() const { return tree.size(); }
+
+    void reserve(size_t n) { tree.reserve(n); }
+
+    // add a new category with index size()
+    void push_back(WEIGHT weight) { tree.push_back(weight); modified(); }
+
+    // remove the highest index category.
+    void pop_back() { tree.pop_back(); modified(); }
+
+    // sets the weight associated with the supplied index
+    EntryRef operator [](int index) { return EntryRef(index, *this); }
+
+    // returns the weight of the supplied index.
+    WEIGHT operator [](int index) const { return get(index); }
+
+    // gets the weight associated with an index
+    WEIGHT get(int index) const { return tree.get(index); }
+
+    // sets the weight associated with an index
+    void set(int index, WEIGHT weight) { tree.set(index, weight); modified(); }
+
+    void setMany(const std::vector<int> &indices, const std::vector<WEIGHT> &weights) {
+        tree.setMany(indices, weights);
+        modified();
+    }
+
+    template<typename ITERATOR>
+    void setMany(ITERATOR begin, ITERATOR end) {
+        tree.setMany(begin, end);
+        modified();
+    }
+
+    // draws a sample from the distribution in proportion to the weights
+    template<typename RNG> int operator()(RNG &generator) const {
+        if(useAliasTable(1)) return aliasSample(generator);
+        return tree(generator);
+    }
+
+    // puts nSamples draws into out, returning the end of the output
+    template<typename RNG, typename OUTPUTITERATOR>
+    OUTPUTITERATOR sample(RNG &generator, size_t nSamples, OUTPUTITERATOR out) const {
+        if(!useAliasTable(nSamples)) return tree.sample(generator, nSamples, out);
+        for(size_t s = 0; s < nSamples; ++s) *out++ = aliasSample(generator);
+        return out;
+    }
+
+    // the sum of all weights (doesn't need to be 1.0)
+    WEIGHT sum() const { return tree.sum(); }
+
+    // Returns the normalised probability of the index'th element
+    double P(int index) const { return tree.P(index); }
+
+    // true if draws are currently being taken from an alias table
+    bool hasAliasTable() const { return !alias.empty(); }
+
+    friend std::ostream &operator <<(std::ostream &out, const MutableCategoricalAdaptiveArray<WEIGHT> &distribution) {
+        return out << distribution.tree;
+    }
+
+protected:
+
+    void modified() {
+        nDrawsBeforeAliasTable = size() == 0 ? 0.0 : aliasBuildCost * size() / std::log2(size() + 1.0);
+        if(!alias.empty()) {
+            alias.clear();
+            aliasThreshold.clear();
+        }
+    }
+
+    // Records nDraws draws and returns true if they should be taken from the alias table,
+    // building the table if the draws since the last modification have now cost as much
+    // as building it.
+    bool useAliasTable(size_t nDraws) const {
+        if(!alias.empty()) return true;
+        nDrawsBeforeAliasTable -= nDraws;
+        if(nDrawsBeforeAliasTable > 0.0 || sum() <= 0) return false;
+        buildAliasTable();
+        return true;
+    }
+
+    template<typename RNG>
+    int aliasSample(RNG &generator) const {
+        int n = alias.size();
+        double u = std::uniform_real_distribution<double>(0.0, n)(generator);
+        int bucket = static_cast<int>(u);
+        if(bucket >= n) bucket = n - 1; // rounding of u to n
+        return (u - bucket < aliasThreshold[bucket]) ? bucket : alias[bucket];
+    }
+
+    void buildAliasTable() const;
+};
+
+
+// Vose's method. Each category's weight is scaled so that the mean is 1. Categories
+// with scaled weight less than 1 ("small") get their own bucket, topped up with the
+// remainder of a category with scaled weight at least 1 ("large").
+template<class WEIGHT>
+void MutableCategoricalAdaptiveArray<WEIGHT>::buildAliasTable() const {
+    int n = size();
+    double scale = n / static_cast<double>(sum());
+    std::vector<double> scaledWeight(n);
+    std::vector<int> small;
+    std::vector<int> large;
+    int nonZeroCategory = 0;
+    for(int i = 0; i < n; ++i) {
+        scaledWeight[i] = static_cast<double>(get(i)) * scale;
+        if(scaledWeight[i] > 0.0) nonZeroCategory = i;
+        (scaledWeight[i] < 1.0 ? small : large).push_back(i);
+    }
+    aliasThreshold.resize(n);
+    alias.resize(n);
+    while(!small.empty() && !large.empty()) {
+        int s = small.back();
+        int l = large.back();
+        small.pop_back();
+        aliasThreshold[s] = scaledWeight[s];
+        alias[s] = l;
+        scaledWeight[l] -= 1.0 - scaledWeight[s];
+        if(scaledWeight[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // anything left over has a scaled weight of 1, to within rounding, unless it's zero
+    for(int l: large) {
+        aliasThreshold[l] = 1.0;
+        alias[l] = l;
+    }
+    for(int s: small) {
+        aliasThreshold[s] = (get(s) == 0) ? 0.0 : 1.0;
+        alias[s] = nonZeroCategory;
+    }
+}
+
+#endif //CPP_MUTABLECATEGORICALADAPTIVEARRAY_H
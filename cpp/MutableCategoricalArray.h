@@ -11,11 +11,30 @@
 //
 // A random draw from the distribution can be taken using the call operator () with
 // a random number generator (e.g. std::mt19937). This also runs in O(log(N)) time.
+// sample64() takes a draw from a single 64 bit output of a generator (e.g. std::mt19937_64
+// or the counter-based Philox4x32), scaled directly to the sum of weights without
+// constructing a std::uniform_*_distribution.
+// Many draws can be taken at once using sample(), which walks several independent
+// draws down the tree in lock-step so that their cache misses overlap.
+//
+// k distinct draws, as if each drawn category's weight were set to zero before the next draw,
+// can be taken in O(k log(N)) time using sampleDistinct(), without modifying the array.
+// Similarly, sampleInRange() draws from only the indices in a range, and sampleExcluding()
+// from all but one index, in O(log(N)) time.
+//
+// The position of a draw in the distribution can also be supplied by the caller (e.g. from a
+// quasi-random sequence, or common random numbers across simulations): quantile(u) is the
+// inverse of the cumulative distribution, in order of index, at u in [0,1), and quantiles()
+// does the same for a sorted range of u's in a single traversal of the tree.
+// findByCumulative() and prefixSum() convert between indices and cumulative weights.
 //
 // The sum of all weights can be accessed in O(1) time using sum()
 //
 // If all probabilities need modifying simultaneously, this can be done in O(N) time using
-// the setAll method.
+// the setAll method. For large arrays, setAll() and construction from a range of weights build
+// the tree on several threads, giving exactly the same tree as a single threaded build.
+// If k probabilities need modifying, setMany() does this in O(min(k log(N), N)) time,
+// updating each shared ancestor in the tree only once.
 //
 // Internally this is stored as a binary sum tree. However, we
 // only store sums for the root node and nodes that are right-hand children. This allows
@@ -34,6 +53,26 @@
 //
 // This encoding allows arrays of any size (not just integer multiples of 2)
 // and allows very efficient modification of probabilities and sampling in O(log(N)) time.
+//
+// The type of the weights is given by the template parameter WEIGHT, which defaults to double.
+// Using float halves the memory footprint. Integer types (e.g. uint32_t or uint64_t counts, or
+// fixed-point weights) give exact sums that never drift however many times weights are modified,
+// and are sampled with an integer uniform draw. Unsigned integer arithmetic wraps, which is fine
+// for the internal deltas, but the sum of all weights must be representable.
+//
+// The tree is held in a STORAGE, which defaults to std::vector<WEIGHT>. Any class with
+// operator[] and size() will do for the const members, and set() if its elements are writable,
+// so, for example, MutableCategoricalArraySnapshot can map a tree saved in a file
+// straight into memory.
+//
+// Draws and updates can be counted by giving an INSTRUMENTATION policy (see
+// MutableCategoricalInstrumentation.h), which costs nothing with the default NoInstrumentation.
+// stats() gives the counts along with the depth of the tree and its memory footprint.
+//
+// If LEAFWEIGHTS is true (see MutableCategoricalArrayWithLeafWeights) the weights are also
+// stored in a separate array. This doubles the memory footprint, but get() becomes a single
+// load, whose result is exactly the weight that was set rather than the difference of two
+// sums, and set() no longer needs to read the node's descendants to find the change in weight.
 #ifndef CPP_MUTABLECATEGORICALARRAY_H
 #define CPP_MUTABLECATEGORICALARRAY_H
 
@@ -41,8 +80,22 @@
 #include <array>
 #include <random>
 #include <ostream>
-
-class MutableCategoricalArray {
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <cassert>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include "MutableCategoricalInstrumentation.h"
+
+template<class WEIGHT> class MutableCategoricalArraySnapshot;
+template<class WEIGHT> class MutableCategoricalGroups;
+
+template<class WEIGHT = double, class STORAGE = std::vector<WEIGHT>, class INSTRUMENTATION = NoInstrumentation, bool LEAFWEIGHTS = false>
+class MutableCategoricalArray: protected INSTRUMENTATION {
 
     // This class allows array operator [] syntax for both reading and writing
     class EntryRef {
@@ -51,30 +104,50 @@ class MutableCategoricalArray {
     public:
 
         EntryRef(int index, MutableCategoricalArray &dist): i(index), p(dist) { }
-        operator double() const { return p.get(i); }
-        double weight() const { return p.get(i); }
-        double operator =(double weight) { p.set(i, weight); return weight; }
-        double operator =(const EntryRef &otherRef) {   // reference assignment semantics
-            double w_i = otherRef.weight();
+        operator WEIGHT() const { return p.get(i); }
+        WEIGHT weight() const { return p.get(i); }
+        WEIGHT operator =(WEIGHT weight) { p.set(i, weight); return weight; }
+        WEIGHT operator =(const EntryRef &otherRef) {   // reference assignment semantics
+            WEIGHT w_i = otherRef.weight();
             p.set(i, w_i); return w_i; }
     };
 
-    std::vector<double> tree;
+    struct NoLeafWeights { };
+
+    STORAGE tree;
     int indexHighestBit;         // 2^(number of bits necessary to hold the highest index in tree).
+    typename std::conditional<LEAFWEIGHTS, std::vector<WEIGHT>, NoLeafWeights>::type leafWeights;
+
+    friend class MutableCategoricalArraySnapshot<WEIGHT>;
+    friend class MutableCategoricalGroups<WEIGHT>;
 
 public:
 
     MutableCategoricalArray(): indexHighestBit(0) { }
 
-    MutableCategoricalArray(int size): tree(size,0.0) {
+    MutableCategoricalArray(int size): tree(size,0) {
         indexHighestBit = highestOneBit(size-1);
+        if constexpr (LEAFWEIGHTS) leafWeights.resize(size, 0);
+    }
+
+    MutableCategoricalArray(int size, std::function<WEIGHT(int)> init): MutableCategoricalArray(size) {
+        for(int i=size-1; i>=0; --i) {
+            WEIGHT weight = init(i);
+            if constexpr (LEAFWEIGHTS) leafWeights[i] = weight;
+            tree[i] = descendantSum(i) + weight;
+        }
     }
 
-    MutableCategoricalArray(int size, std::function<double(int)> init): MutableCategoricalArray(size) {
-        for(int i=size-1; i>=0; --i) tree[i] = descendantSum(i) + init(i);
+    // As above, but calls init and builds the tree on nThreads threads, so init must be
+    // safe to call concurrently.
+    MutableCategoricalArray(int size, std::function<WEIGHT(int)> init, int nThreads): MutableCategoricalArray(size) {
+        forEachRange(size, nThreads, [this, &init](int begin, int end) {
+            for(int i=begin; i<end; ++i) tree[i] = init(i);
+        });
+        buildTree(nThreads);
     }
 
-    MutableCategoricalArray(std::initializer_list<double> values): MutableCategoricalArray(values.size()) {
+    MutableCategoricalArray(std::initializer_list<WEIGHT> values): MutableCategoricalArray(values.size()) {
         setAll(values);
     }
 
@@ -83,29 +156,35 @@ public:
                     std::is_convertible<
                             typename std::iterator_traits<ITERATOR>::iterator_category,
                             std::input_iterator_tag
-                    >::value
-                            >::type>
+                    >::value, int
+            >::type = 0>
     MutableCategoricalArray(ITERATOR begin, ITERATOR end): tree(begin, end) {
-        for(int i=tree.size()-1; i>=0; --i) tree[i] += descendantSum(i);
+        indexHighestBit = highestOneBit(tree.size()-1);
+        buildTree(defaultThreads());
     }
 
 
     size_t size() const { return tree.size(); }
 
-    void reserve(size_t n) { tree.reserve(n); }
+    void reserve(size_t n) {
+        tree.reserve(n);
+        if constexpr (LEAFWEIGHTS) leafWeights.reserve(n);
+    }
 
     // add a new category with index size()
-    void push_back(double weight) {
+    void push_back(WEIGHT weight) {
         int newIndex = tree.size();
-        tree.push_back(0.0);
+        tree.push_back(0);
+        if constexpr (LEAFWEIGHTS) leafWeights.push_back(0);
         indexHighestBit = highestOneBit(newIndex);
         set(newIndex, weight);
     }
 
     // remove the highest index category.
     void pop_back() {
-        set(size()-1, 0.0);
+        set(size()-1, 0);
         tree.pop_back();
+        if constexpr (LEAFWEIGHTS) leafWeights.pop_back();
         indexHighestBit = highestOneBit(size()-1);
     }
 
@@ -113,62 +192,170 @@ public:
     EntryRef operator [](int index) { return EntryRef(index, *this); }
 
     // returns the weight of the supplied index.
-    double operator [](int index) const { return get(index); }
+    WEIGHT operator [](int index) const { return get(index); }
 
     // gets the weight associated with an index
-    double get(int index) const { return tree[index] - descendantSum(index); }
+    WEIGHT get(int index) const {
+        if constexpr (LEAFWEIGHTS) {
+            return leafWeights[index];
+        } else {
+            return tree[index] - descendantSum(index);
+        }
+    }
 
     // sets the weight associated with an index
-    void set(int index, double weight) {
-        double sum = weight;
+    void set(int index, WEIGHT weight) {
+        if constexpr (LEAFWEIGHTS) {
+            setFromLeafWeight(index, weight);
+            return;
+        }
+        WEIGHT sum = weight;
         int indexOffset = 1;
+        long nodesVisited = 1;
         while((indexOffset & index) == 0 && indexOffset < size()) {
             int descendantIndex = index + indexOffset;
-            if(descendantIndex < size()) sum += tree[descendantIndex];
+            if(descendantIndex < size()) {
+                sum += tree[descendantIndex];
+                ++nodesVisited;
+            }
             indexOffset = indexOffset << 1;
         }
-        double delta = sum - tree[index];
+        WEIGHT delta = sum - tree[index];
         int ancestorIndex = index;
         tree[index] = sum;
         while(indexOffset < size()) {
             ancestorIndex = ancestorIndex ^ indexOffset;
             tree[ancestorIndex] += delta;
+            ++nodesVisited;
             do {
                 indexOffset = indexOffset << 1;
             } while((ancestorIndex & indexOffset) == 0 && indexOffset < size());
         }
+        this->recordUpdates(1, nodesVisited);
+    }
+
+
+    // Sets the weight of indices[j] to weights[j] for each j. The result is the same as calling
+    // set() for each pair in turn (so if an index appears more than once, its last weight is taken)
+    // but each node of the tree is updated at most once.
+    void setMany(const std::vector<int> &indices, const std::vector<WEIGHT> &weights) {
+        assert(indices.size() == weights.size());
+        std::vector<std::pair<int,WEIGHT>> updates;
+        updates.reserve(indices.size());
+        for(size_t j=0; j<indices.size(); ++j) updates.emplace_back(indices[j], weights[j]);
+        setMany(updates);
     }
 
+    // As above, but takes a range of (index, weight) pairs.
+    template<typename ITERATOR>
+    void setMany(ITERATOR begin, ITERATOR end) {
+        std::vector<std::pair<int,WEIGHT>> updates(begin, end);
+        setMany(updates);
+    }
 
     // draws a sample from the distribution in proportion to the weights
-    template<typename RNG> int operator()(RNG &generator) const;
+    template<typename RNG> int operator()(RNG &generator) const {
+        return findByTarget(targetDistribution()(generator));
+    }
 
+    // Draws a sample using exactly one call to a generator that returns uniform 64 bit words.
+    // This is faster than operator() but doesn't give the same draws.
+    template<typename RNG> int sample64(RNG &generator) const {
+        static_assert(RNG::min() == 0 && RNG::max() == std::numeric_limits<uint64_t>::max(),
+                "sample64() needs a generator of full 64 bit words");
+        return sampleFromBits(generator());
+    }
 
-    // Sets the un-normalised probabilities of the first N integers
+    // The draw that sample64() takes from the uniform 64 bit word, bits. For floating point
+    // weights the top 53 bits are scaled to [0,sum()). For integer weights the target is
+    // the high word of bits*sum(), which favours some targets over others by at most one part
+    // in 2^64/sum().
+    int sampleFromBits(uint64_t bits) const { return findByTarget(targetFromBits(bits)); }
+
+    // draws nSamples independent samples and writes them, in order of drawing, to out.
+    // Returns the output iterator after the last sample written.
+    template<typename RNG, typename OUTPUTITERATOR>
+    OUTPUTITERATOR sample(RNG &generator, size_t nSamples, OUTPUTITERATOR out) const;
+
+    // Draws k distinct indices without replacement (i.e. successive sampling, where each draw
+    // is from the distribution with the weights of the previous draws set to zero) and writes
+    // them, in order of drawing, to out. Fewer than k are drawn if fewer than k categories have
+    // non-zero weight. Returns the output iterator after the last index written.
+    template<typename RNG, typename OUTPUTITERATOR>
+    OUTPUTITERATOR sampleDistinct(RNG &generator, size_t k, OUTPUTITERATOR out) const;
+
+    // Draws a sample from the indices begin...end-1 only, as if all other weights were zero,
+    // in O(log(N)) time without modifying the array, so it's safe on a shared array. Returns -1
+    // if the range has no weight.
+    template<typename RNG>
+    int sampleInRange(RNG &generator, int begin, int end) const;
+
+    // Draws a sample as if the weight of index excluded were zero (e.g. to choose a partner
+    // other than oneself), in O(log(N)) time without modifying the array. Returns -1 if no
+    // other index has weight.
+    template<typename RNG>
+    int sampleExcluding(RNG &generator, int excluded) const;
+
+    // Returns the index i such that prefixSum(i) <= cumulativeWeight < prefixSum(i+1)
+    // for 0 <= cumulativeWeight < sum(), in O(log(N)) time.
+    int findByCumulative(WEIGHT cumulativeWeight) const;
+
+    // the sum of the weights of all indices less than index, in O(log(N)) time
+    WEIGHT prefixSum(int index) const;
+
+    // the index at u in [0,1) of the cumulative distribution, i.e. findByCumulative(u * sum())
+    int quantile(double u) const { return findByCumulative(cumulativeWeightOf(u)); }
+
+    // Writes quantile(u) to out for each u in the sorted range [begin, end). The u's are
+    // divided between the halves of each subtree as the tree is descended, so each node is
+    // visited at most once however many u's pass through it.
+    template<typename RANDOMACCESSITERATOR, typename OUTPUTITERATOR>
+    OUTPUTITERATOR quantiles(RANDOMACCESSITERATOR begin, RANDOMACCESSITERATOR end, OUTPUTITERATOR out) const {
+        if(begin == end) return out;
+        return quantilesInSubtree(0, indexHighestBit, sum(), 0, begin, end, out);
+    }
+
+
+    // Sets the un-normalised probabilities of the first values.size() integers,
+    // which should be the size of this array.
     // Runs in O(N) time since descendantSum runs in amortized constant
-    // time (simce average number of steps is 2 for any size of tree).
+    // time (since average number of steps is 2 for any size of tree).
     template<typename RANDOMACCESSCONTAINER>
     void setAll(const RANDOMACCESSCONTAINER &values) {
-        for(int i = values.nCategories() - 1; i >= 0; --i) {
-            tree[i] = descendantSum(i) + values[i];
-        }
+        assert(values.size() == size());
+        int nThreads = defaultThreads();
+        forEachRange(size(), nThreads, [this, &values](int begin, int end) {
+            for(int i=begin; i<end; ++i) tree[i] = values[i];
+        });
+        buildTree(nThreads);
     }
 
-    void setAll(std::initializer_list<double> values) {
+    void setAll(std::initializer_list<WEIGHT> values) {
         auto it = std::rbegin(values);
         for(int i = values.size()-1; i>=0; --i) {
+            if constexpr (LEAFWEIGHTS) leafWeights[i] = *it;
             tree[i] = descendantSum(i) + *it++;
         }
     }
 
     // the sum of all weights (doesn't need to be 1.0)
-    double sum() const { return size()==0?0.0:tree[0]; }
+    WEIGHT sum() const { return size()==0?0:tree[0]; }
 
     // Returns the normalised probability of the index'th element
-    double P(int index) const { return get(index) / sum(); }
+    double P(int index) const { return static_cast<double>(get(index)) / sum(); }
+
+    // The instrumentation counts, the number of levels of the tree and the memory footprint
+    MutableCategoricalStats stats() const {
+        MutableCategoricalStats stats;
+        this->addCounts(stats);
+        for(int offset = indexHighestBit; offset != 0; offset >>= 1) stats.expectedDepth += 1.0;
+        stats.memoryBytes = sizeof(*this) + capacityOf(tree, 0) * sizeof(WEIGHT);
+        if constexpr (LEAFWEIGHTS) stats.memoryBytes += leafWeights.capacity() * sizeof(WEIGHT);
+        return stats;
+    }
 
     friend std::ostream &operator <<(std::ostream &out, const MutableCategoricalArray &distribution) {
-        for(int i=0; i<distribution.tree.size(); ++i) {
+        for(int i=0; i<distribution.size(); ++i) {
             out << distribution[i] << " ";
         }
         return out;
@@ -176,11 +363,70 @@ public:
 
 protected:
 
+    // Distribution of the target cumulative weight of a sample, which is uniform over [0,sum()).
+    // Integer weights are sampled with an integer distribution, so there's no conversion to floating point.
+    typedef typename std::conditional<std::is_integral<WEIGHT>::value,
+            std::uniform_int_distribution<WEIGHT>,
+            std::uniform_real_distribution<WEIGHT>>::type uniform_distribution_type;
+
+    uniform_distribution_type targetDistribution() const { return targetDistribution(sum()); }
+
+    // uniform over [0,total)
+    static uniform_distribution_type targetDistribution(WEIGHT total) {
+        if constexpr (std::is_integral<WEIGHT>::value) {
+            return uniform_distribution_type(0, total - 1);
+        } else {
+            return uniform_distribution_type(0, total);
+        }
+    }
+
+    // redraws allowed when rounding error gives an index that can't be drawn
+    static constexpr int maxConsecutiveRedraws = 64;
+
+    WEIGHT targetFromBits(uint64_t bits) const {
+        if constexpr (std::is_integral<WEIGHT>::value) {
+            return static_cast<WEIGHT>(multiplyHigh(bits, static_cast<uint64_t>(sum())));
+        } else {
+            WEIGHT target = static_cast<WEIGHT>((bits >> 11) * 0x1.0p-53 * sum());
+            return target < sum() ? target : std::nextafter(sum(), WEIGHT(0)); // rounding of float
+        }
+    }
+
+    // the high 64 bits of the 128 bit product a*b
+    static uint64_t multiplyHigh(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+        return static_cast<uint64_t>((static_cast<unsigned __int128>(a) * b) >> 64);
+#else
+        uint64_t aLow = a & 0xffffffff, aHigh = a >> 32;
+        uint64_t bLow = b & 0xffffffff, bHigh = b >> 32;
+        uint64_t middle = aHigh * bLow + ((aLow * bLow) >> 32);
+        uint64_t middle2 = aLow * bHigh + (middle & 0xffffffff);
+        return aHigh * bHigh + (middle >> 32) + (middle2 >> 32);
+#endif
+    }
+
+    // descends the tree in the order of operator(), to the index containing target in [0,sum())
+    int findByTarget(WEIGHT target) const;
+
+    WEIGHT cumulativeWeightOf(double u) const {
+        if constexpr (std::is_integral<WEIGHT>::value) {
+            if(sum() == 0) return 0;
+            WEIGHT cumulativeWeight = static_cast<WEIGHT>(u * sum());
+            return cumulativeWeight < sum() ? cumulativeWeight : sum() - 1;
+        } else {
+            return u * sum();
+        }
+    }
+
+    template<typename RANDOMACCESSITERATOR, typename OUTPUTITERATOR>
+    OUTPUTITERATOR quantilesInSubtree(int index, int rightChildOffset, WEIGHT subtreeSum, WEIGHT subtreeStart,
+                                      RANDOMACCESSITERATOR begin, RANDOMACCESSITERATOR end, OUTPUTITERATOR out) const;
+
     // Calculates the sum of all right children associated with a given node
     // (under left-child deletion).
-    double descendantSum(int index) const {
+    WEIGHT descendantSum(int index) const {
         int indexOffset = 1;
-        double sum = 0.0;
+        WEIGHT sum = 0;
         while((indexOffset & index) == 0 && indexOffset < size()) {
             int descendantIndex = index + indexOffset;
             if(descendantIndex < size()) sum += tree[descendantIndex];
@@ -189,6 +435,96 @@ protected:
         return sum;
     }
 
+    void setMany(std::vector<std::pair<int,WEIGHT>> &updates);
+
+    // With leaf weights, the change in the weight is known, so it can be added straight to
+    // the node and its ancestors, which are found by clearing the lowest set bit.
+    void setFromLeafWeight(int index, WEIGHT weight) {
+        WEIGHT delta = weight - leafWeights[index];
+        leafWeights[index] = weight;
+        tree[index] += delta;
+        long nodesVisited = 1;
+        while(index != 0) {
+            index &= index - 1;
+            tree[index] += delta;
+            ++nodesVisited;
+        }
+        this->recordUpdates(1, nodesVisited);
+    }
+
+    // arrays at least this big are built on more than one thread by default
+    static constexpr int minParallelBuildSize = 1 << 20;
+    // smallest number of categories that a thread builds on its own
+    static constexpr int minBuildBlockSize = 1 << 16;
+
+    int defaultThreads() const {
+        return size() < minParallelBuildSize ? 1 : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Calls f(begin, end) on nThreads threads, for contiguous ranges that cover 0...n-1.
+    template<class FUNCTION>
+    static void forEachRange(int n, int nThreads, const FUNCTION &f) {
+        nThreads = std::min(nThreads, n);
+        if(nThreads <= 1) {
+            f(0, n);
+            return;
+        }
+        std::vector<std::thread> threads;
+        for(int t = 0; t < nThreads; ++t) {
+            threads.emplace_back(f, static_cast<int>(long(n) * t / nThreads), static_cast<int>(long(n) * (t+1) / nThreads));
+        }
+        for(std::thread &thread: threads) thread.join();
+    }
+
+    void buildTree(int nThreads);
+
+    // Stable sort of (index, weight) pairs by index. Sorting dominates the cost of a sparse
+    // setMany() so we use an LSD radix sort with 11-bit digits, which is O(k). Each pass clears
+    // and sums 2048 buckets though, so small batches (e.g. the few rates that change when an
+    // event fires in GillespieSimulation) are insertion sorted instead.
+    void radixSortByIndex(std::vector<std::pair<int,WEIGHT>> &updates) const {
+        if(updates.size() <= maxInsertionSort) {
+            for(size_t i = 1; i < updates.size(); ++i) {
+                std::pair<int,WEIGHT> update = updates[i];
+                size_t j = i;
+                for(; j > 0 && updates[j-1].first > update.first; --j) updates[j] = updates[j-1];
+                updates[j] = update;
+            }
+            return;
+        }
+        const int digitBits = 11;
+        const int nBuckets = 1 << digitBits;
+        std::vector<std::pair<int,WEIGHT>> sorted(updates.size());
+        std::vector<size_t> bucketStart(nBuckets + 1);
+        for(int shift = 0; shift < 31 && (indexHighestBit >> shift) != 0; shift += digitBits) {
+            std::fill(bucketStart.begin(), bucketStart.end(), 0);
+            for(const std::pair<int,WEIGHT> &update: updates) ++bucketStart[((update.first >> shift) & (nBuckets - 1)) + 1];
+            for(int bucket = 1; bucket <= nBuckets; ++bucket) bucketStart[bucket] += bucketStart[bucket - 1];
+            for(const std::pair<int,WEIGHT> &update: updates) sorted[bucketStart[(update.first >> shift) & (nBuckets - 1)]++] = update;
+            updates.swap(sorted);
+        }
+    }
+
+    // true if index is a leaf in the subtree whose sum is stored at node
+    static bool subtreeContains(int node, int index) {
+        return node == 0 || (index >= node && index - node < (node & -node));
+    }
+
+    static constexpr size_t maxInsertionSort = 32;
+
+    // number of draws that sample() walks down the tree together
+    static constexpr int nSampleLanes = 8;
+
+    void prefetch(int index) const {
+#if defined(__GNUC__)
+        if(index < size()) __builtin_prefetch(&tree[index]);
+#endif
+    }
+
+    // the capacity of a std::vector, or the size of any other STORAGE
+    template<class S> static auto capacityOf(const S &storage, int) -> decltype(storage.capacity()) { return storage.capacity(); }
+    template<class S> static size_t capacityOf(const S &storage, long) { return storage.size(); }
+
     static int highestOneBit(int i) {
         i = i | (i >> 1);
         i = i | (i >> 2);
@@ -200,19 +536,295 @@ protected:
 };
 
 
-template<typename RNG>
-int MutableCategoricalArray::operator()(RNG &generator) const {
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+int MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::findByTarget(WEIGHT target) const {
     int index = 0;
-    double target = std::uniform_real_distribution<double>(0.0, sum())(generator);
+    long nodesVisited = 0;
     int rightChildOffset = indexHighestBit;
     while(rightChildOffset != 0) {
         int childIndex = index+rightChildOffset;
         if(childIndex < size()) {
             if (tree[childIndex] > target) index += rightChildOffset; else target -= tree[childIndex];
+            ++nodesVisited;
+        }
+        rightChildOffset = rightChildOffset >> 1;
+    }
+    this->recordSamples(1, nodesVisited);
+    return index;
+}
+
+
+// If the updates are dense (k log(N) > N) we rebuild the whole tree in O(N) time. Otherwise
+// we calculate the change in weight of each updated index and visit the updated indices in
+// increasing order. The subtree under a node with index i covers the indices i...i+lowestOneBit(i)-1
+// so, in this order, the nodes whose subtree contains the current index form a path
+// from the root which we keep as a stack. Each node on the stack accumulates the changes
+// in weight in its subtree and, once we move past its subtree, it is updated and passes its
+// accumulated change to its parent. So each node is updated exactly once.
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+void MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::setMany(std::vector<std::pair<int,WEIGHT>> &updates) {
+    if(updates.size() * std::log2(size() + 1.0) > size()) {
+        std::vector<WEIGHT> weights(size());
+        for(int i=0; i<size(); ++i) weights[i] = get(i);
+        for(const std::pair<int,WEIGHT> &update: updates) weights[update.first] = update.second;
+        for(int i=0; i<size(); ++i) tree[i] = weights[i];
+        buildTree(defaultThreads());
+        this->recordUpdates(updates.size(), size());
+        return;
+    }
+
+    radixSortByIndex(updates);
+    std::vector<std::pair<int,WEIGHT>> openNodes; // path of (node index, accumulated delta) from the root
+    long nodesVisited = 0;
+    auto closeTopNode = [&]() {
+        ++nodesVisited;
+        std::pair<int,WEIGHT> node = openNodes.back();
+        openNodes.pop_back();
+        tree[node.first] += node.second;
+        if(!openNodes.empty()) openNodes.back().second += node.second;
+    };
+    for(auto update = updates.begin(); update != updates.end(); ++update) {
+        int index = update->first;
+        if(std::next(update) != updates.end() && std::next(update)->first == index) continue; // last one wins
+        while(!openNodes.empty() && !subtreeContains(openNodes.back().first, index)) closeTopNode();
+        // push the path from the current top down to index. Ancestors are found by clearing the lowest bit.
+        int pathTop = openNodes.empty() ? -1 : openNodes.back().first;
+        size_t pathStart = openNodes.size();
+        for(int node = index; node != pathTop; node &= node - 1) {
+            openNodes.emplace_back(node, 0);
+            if(node == 0) break;
+        }
+        std::reverse(openNodes.begin() + pathStart, openNodes.end());
+        openNodes.back().second = update->second - get(index);
+        if constexpr (LEAFWEIGHTS) leafWeights[index] = update->second;
+    }
+    while(!openNodes.empty()) closeTopNode();
+    this->recordUpdates(updates.size(), nodesVisited);
+}
+
+// Turns an array of weights, stored in tree, into the tree itself (first copying them to
+// leafWeights if there are leaf weights) by calculating
+// tree[i] = descendantSum(i) + tree[i] for each i in decreasing order. The subtree under node i
+// covers i...i+lowestOneBit(i)-1, so if we split the array into blocks whose size is a power of two,
+// the subtrees of all nodes in a block, other than its first node, lie within the block. So the
+// blocks can be built independently, leaving the first nodes of the blocks, whose subtrees may
+// include other blocks, to be built afterwards in decreasing order. Each node is calculated
+// with the same sums in the same order as the single threaded build, so the result is identical.
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+void MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::buildTree(int nThreads) {
+    int n = size();
+    if constexpr (LEAFWEIGHTS) {
+        leafWeights.resize(n);
+        forEachRange(n, nThreads, [this](int begin, int end) {
+            for(int i=begin; i<end; ++i) leafWeights[i] = tree[i];
+        });
+    }
+    int blockSize = std::max(minBuildBlockSize, highestOneBit(n / (4 * std::max(nThreads, 1))));
+    int nBlocks = (n + blockSize - 1) / blockSize;
+    if(nThreads <= 1 || nBlocks < 2) {
+        for(int i=n-1; i>=0; --i) tree[i] = descendantSum(i) + tree[i];
+        return;
+    }
+    forEachRange(nBlocks, nThreads, [this, n, blockSize](int beginBlock, int endBlock) {
+        for(int block = endBlock - 1; block >= beginBlock; --block) {
+            int blockStart = block * blockSize;
+            int blockEnd = static_cast<int>(std::min(long(blockStart) + blockSize, long(n)));
+            for(int i = blockEnd - 1; i > blockStart; --i) tree[i] = descendantSum(i) + tree[i];
+        }
+    });
+    for(int block = nBlocks - 1; block >= 0; --block) {
+        int blockStart = block * blockSize;
+        tree[blockStart] = descendantSum(blockStart) + tree[blockStart];
+    }
+}
+
+// Rather than modifying the tree, the weights of the drawn categories are recorded in an overlay
+// that holds, for each node on the path from a drawn category to the root, the total weight drawn
+// from under that node, and the descent subtracts this from the node's sum. Rounding error
+// in the subtraction can very occasionally lead a floating point draw to an already drawn
+// category, in which case we draw again, giving up if every draw is of drawn categories,
+// which means that only rounding error is left.
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+template<typename RNG, typename OUTPUTITERATOR>
+OUTPUTITERATOR MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::sampleDistinct(RNG &generator, size_t k, OUTPUTITERATOR out) const {
+    std::unordered_map<int,WEIGHT> drawnWeight;   // node -> weight drawn from its subtree
+    std::unordered_set<int> drawn;
+    auto remainingSum = [&](int node) {
+        auto drawnEntry = drawnWeight.find(node);
+        return drawnEntry == drawnWeight.end() ? tree[node] : tree[node] - drawnEntry->second;
+    };
+    int nRedraws = 0;
+    while(drawn.size() < k && drawn.size() < size() && nRedraws < maxConsecutiveRedraws) {
+        WEIGHT total = remainingSum(0);
+        if(total <= 0) break;
+        WEIGHT target = targetDistribution(total)(generator);
+        int index = 0;
+        long nodesVisited = 0;
+        int rightChildOffset = indexHighestBit;
+        while(rightChildOffset != 0) {
+            int childIndex = index + rightChildOffset;
+            if(childIndex < size()) {
+                WEIGHT childSum = remainingSum(childIndex);
+                if (childSum > target) index = childIndex; else target -= childSum;
+                ++nodesVisited;
+            }
+            rightChildOffset = rightChildOffset >> 1;
+        }
+        this->recordSamples(1, nodesVisited);
+        if(get(index) == 0 || !drawn.insert(index).second) { // only possible through rounding error
+            ++nRedraws;
+            continue;
+        }
+        nRedraws = 0;
+        *out++ = index;
+        WEIGHT weight = get(index);
+        for(int node = index; ; node &= node - 1) { // ancestors are found by clearing the lowest bit
+            drawnWeight[node] += weight;
+            if(node == 0) break;
+        }
+    }
+    return out;
+}
+
+// The descent of operator() chooses the upper half of each subtree first, which is quicker
+// since the sum of the upper half is stored at its node, but means that cumulative weight
+// increases with decreasing index. To go in order of index, we keep track of the sum of the
+// current subtree, from which we get the sum of its lower half.
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+int MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::findByCumulative(WEIGHT cumulativeWeight) const {
+    int index = 0;
+    long nodesVisited = 0;
+    WEIGHT subtreeSum = sum();
+    int rightChildOffset = indexHighestBit;
+    while(rightChildOffset != 0) {
+        int childIndex = index + rightChildOffset;
+        if(childIndex < size()) {
+            WEIGHT lowerSum = subtreeSum - tree[childIndex];
+            if(cumulativeWeight < lowerSum) {
+                subtreeSum = lowerSum;
+            } else {
+                cumulativeWeight -= lowerSum;
+                subtreeSum = tree[childIndex];
+                index = childIndex;
+            }
+            ++nodesVisited;
         }
         rightChildOffset = rightChildOffset >> 1;
     }
+    this->recordSamples(1, nodesVisited);
     return index;
 }
 
+// Draws a cumulative weight in [prefixSum(begin), prefixSum(end)) and finds its index. Rounding
+// error in the prefix sums can, rarely, give an index just outside the range, which is redrawn.
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+template<typename RNG>
+int MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::sampleInRange(RNG &generator, int begin, int end) const {
+    assert(0 <= begin && begin <= end && end <= size());
+    WEIGHT lowerSum = prefixSum(begin);
+    WEIGHT rangeSum = prefixSum(end) - lowerSum;
+    if(!(rangeSum > 0)) return -1;
+    uniform_distribution_type uniform = targetDistribution(rangeSum);
+    for(int nRedraws = 0; nRedraws < maxConsecutiveRedraws; ++nRedraws) {
+        int index = findByCumulative(lowerSum + uniform(generator));
+        if(index >= begin && index < end && get(index) != 0) return index;
+    }
+    return -1;
+}
+
+// Draws a cumulative weight in [0, sum() - get(excluded)) and, if it's beyond the start of
+// excluded, skips over the weight of excluded.
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+template<typename RNG>
+int MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::sampleExcluding(RNG &generator, int excluded) const {
+    WEIGHT excludedWeight = get(excluded);
+    WEIGHT excludedStart = prefixSum(excluded);
+    WEIGHT remainingSum = sum() - excludedWeight;
+    if(!(remainingSum > 0)) return -1;
+    uniform_distribution_type uniform = targetDistribution(remainingSum);
+    for(int nRedraws = 0; nRedraws < maxConsecutiveRedraws; ++nRedraws) {
+        WEIGHT target = uniform(generator);
+        if(target >= excludedStart) target += excludedWeight;
+        int index = findByCumulative(target);
+        if(index != excluded && get(index) != 0) return index;
+    }
+    return -1;
+}
+
+// The indices from index upwards are covered by the subtrees of the nodes index,
+// index + lowestOneBit(index), ... whose lowest bits increase at each step.
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+WEIGHT MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::prefixSum(int index) const {
+    if(index == 0) return 0;
+    WEIGHT suffixSum = 0;
+    for(long node = index; node < long(size()); node += node & -node) suffixSum += tree[node];
+    return sum() - suffixSum;
+}
+
+// The u's in [begin, end) all lie in the subtree of index, whose indices are in
+// [index, index + 2*rightChildOffset) and whose cumulative weights start at subtreeStart.
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+template<typename RANDOMACCESSITERATOR, typename OUTPUTITERATOR>
+OUTPUTITERATOR MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::quantilesInSubtree(
+        int index, int rightChildOffset, WEIGHT subtreeSum, WEIGHT subtreeStart,
+        RANDOMACCESSITERATOR begin, RANDOMACCESSITERATOR end, OUTPUTITERATOR out) const {
+    while(rightChildOffset != 0 && index + rightChildOffset >= size()) rightChildOffset >>= 1;
+    if(rightChildOffset == 0) {
+        this->recordSamples(end - begin, 0);
+        for(; begin != end; ++begin) *out++ = index;
+        return out;
+    }
+    int childIndex = index + rightChildOffset;
+    WEIGHT upperStart = subtreeStart + (subtreeSum - tree[childIndex]);
+    RANDOMACCESSITERATOR split = std::partition_point(begin, end, [this, upperStart](double u) {
+        return cumulativeWeightOf(u) < upperStart;
+    });
+    this->recordSamples(0, 1);
+    if(split != begin) out = quantilesInSubtree(index, rightChildOffset >> 1, subtreeSum - tree[childIndex], subtreeStart, begin, split, out);
+    if(split != end) out = quantilesInSubtree(childIndex, rightChildOffset >> 1, tree[childIndex], upperStart, split, end, out);
+    return out;
+}
+
+// Each block of nSampleLanes draws descends the tree level by level. All draws are at the
+// same level at the same time (the tree has leaves all at the same depth) so, once a draw
+// has chosen its branch, we can prefetch the node it will need at the next level and
+// move on to the other draws while that load is in flight.
+template<class WEIGHT, class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+template<typename RNG, typename OUTPUTITERATOR>
+OUTPUTITERATOR MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS>::sample(RNG &generator, size_t nSamples, OUTPUTITERATOR out) const {
+    uniform_distribution_type uniform = targetDistribution();
+    int index[nSampleLanes];
+    WEIGHT target[nSampleLanes];
+    size_t nDraws = nSamples;
+    long nodesVisited = 0;
+    while(nSamples > 0) {
+        int nLanes = nSamples < nSampleLanes ? nSamples : nSampleLanes;
+        for(int lane = 0; lane < nLanes; ++lane) {
+            index[lane] = 0;
+            target[lane] = uniform(generator);
+        }
+        prefetch(indexHighestBit);
+        int rightChildOffset = indexHighestBit;
+        while(rightChildOffset != 0) {
+            int nextOffset = rightChildOffset >> 1;
+            for(int lane = 0; lane < nLanes; ++lane) {
+                int childIndex = index[lane] + rightChildOffset;
+                if(childIndex < size()) {
+                    if (tree[childIndex] > target[lane]) index[lane] = childIndex; else target[lane] -= tree[childIndex];
+                    ++nodesVisited;
+                }
+                if(nextOffset != 0) prefetch(index[lane] + nextOffset);
+            }
+            rightChildOffset = nextOffset;
+        }
+        for(int lane = 0; lane < nLanes; ++lane) *out++ = index[lane];
+        nSamples -= nLanes;
+    }
+    this->recordSamples(nDraws, nodesVisited);
+    return out;
+}
+
+template<class WEIGHT = double>
+using MutableCategoricalArrayWithLeafWeights = MutableCategoricalArray<WEIGHT, std::vector<WEIGHT>, NoInstrumentation, true>;
+
 #endif //CPP_MUTABLECATEGORICALARRAY_H
@@ -0,0 +1,302 @@
+// Binary snapshots of MutableCategoricalArrays.
+//
+// A snapshot is a 64 byte header followed by the raw tree of the array (see
+// MutableCategoricalArray.h), in native byte order, so loading a snapshot doesn't need
+// to rebuild the tree. A snapshot can be written from an array with write(), or written
+// one weight at a time, without ever holding the array in memory, with a Writer.
+// A snapshot can be read into a MutableCategoricalArray with read() or, on POSIX systems,
+// mapped into memory with map(). This gives a MutableCategoricalArray whose tree is the
+// mapped file, so it's ready to sample from immediately, without copying, and pages of the
+// file are only read as they're touched. A READ_ONLY mapping is shared with any other process
+// that maps the same file, while a COPY_ON_WRITE mapping can also be modified with set(),
+// which copies the modified pages privately, leaving the file unchanged.
+//
+// Errors in reading or writing files are reported by throwing std::runtime_error.
+#ifndef CPP_MUTABLECATEGORICALARRAYSNAPSHOT_H
+#define CPP_MUTABLECATEGORICALARRAYSNAPSHOT_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include "MutableCategoricalArray.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+template<class WEIGHT = double>
+class MutableCategoricalArraySnapshot {
+public:
+    struct Header {
+        char        magic[8];       // "MUTCATAR"
+        uint32_t    version;
+        uint32_t    byteOrder;      // byteOrderMark in the byte order of the writer
+        uint32_t    weightSize;     // sizeof(WEIGHT)
+        uint32_t    weightKind;     // see kindOfWeight()
+        uint64_t    nCategories;
+        char        padding[32];    // pads to 64 bytes, so the tree is aligned
+
+        Header(uint64_t nCategories = 0): version(currentVersion), byteOrder(byteOrderMark),
+            weightSize(sizeof(WEIGHT)), weightKind(kindOfWeight()), nCategories(nCategories), padding() {
+            std::memcpy(magic, "MUTCATAR", 8);
+        }
+
+        // throws if this isn't a header for a snapshot of WEIGHTs that can be read on this machine
+        void validate() const;
+    };
+    static_assert(sizeof(Header) == 64, "Snapshot header should be 64 bytes");
+
+    static constexpr uint32_t currentVersion = 1;
+    static constexpr uint32_t byteOrderMark = 0x01020304;
+
+    // 0 for floating point weights, 1 for signed integers and 2 for unsigned integers
+    static constexpr uint32_t kindOfWeight() {
+        return std::is_floating_point<WEIGHT>::value ? 0 : (std::is_signed<WEIGHT>::value ? 1 : 2);
+    }
+
+    template<class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+    static void write(const MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS> &distribution, std::ostream &out);
+
+    static MutableCategoricalArray<WEIGHT> read(std::istream &in);
+
+
+    // Writes a snapshot of an array given its weights in order of index, in O(N) time,
+    // holding only a fixed size buffer and the O(log(N)) nodes of the tree whose subtrees
+    // haven't yet been completed. These are written with a seek when complete, so out must be
+    // seekable (e.g. a std::ofstream opened in binary mode). The snapshot is identical to
+    // the one written by write() for a MutableCategoricalArray with the same weights.
+    class Writer {
+    public:
+        explicit Writer(std::ostream &out): out(out), start(out.tellp()), nCategories(0), bufferStart(0) {
+            Header header;
+            out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+            buffer.reserve(bufferSize);
+        }
+
+        Writer(const Writer &other) = delete;
+        Writer &operator =(const Writer &other) = delete;
+
+        ~Writer() {
+            try {
+                close();
+            } catch(const std::runtime_error &error) { } // call close() to see errors
+        }
+
+        // adds a category with index equal to the number of categories already written
+        void push_back(WEIGHT weight);
+
+        // completes the snapshot. No more weights can be written after this.
+        void close();
+
+    protected:
+        struct OpenNode {
+            int     index;
+            WEIGHT  weight;
+            WEIGHT  descendantSum; // sum of completed children, in order of index
+        };
+
+        static constexpr size_t bufferSize = 1 << 16;
+
+        std::ostream &          out;
+        std::streampos          start;
+        int                     nCategories;
+        bool                    closed = false;
+        std::vector<WEIGHT>     buffer;         // tree values for indices bufferStart...
+        int                     bufferStart;
+        std::vector<OpenNode>   openNodes;      // path from the root to the last node pushed
+
+        void closeTopNode();
+        void writeNode(int index, WEIGHT value);
+        void flushBuffer();
+    };
+
+
+#if defined(__unix__) || defined(__APPLE__)
+    enum MapMode { READ_ONLY, COPY_ON_WRITE };
+
+    // A tree in a memory mapped snapshot file, for use as the STORAGE of a MutableCategoricalArray
+    class MappedTree {
+    public:
+        MappedTree(): mapping(nullptr), mappingLength(0), tree(nullptr), nCategories(0), writable(false) { }
+        MappedTree(MappedTree &&other) noexcept: MappedTree() { *this = std::move(other); }
+        MappedTree &operator =(MappedTree &&other) noexcept {
+            std::swap(mapping, other.mapping);
+            std::swap(mappingLength, other.mappingLength);
+            std::swap(tree, other.tree);
+            std::swap(nCategories, other.nCategories);
+            std::swap(writable, other.writable);
+            return *this;
+        }
+        ~MappedTree() { if(mapping != nullptr) munmap(mapping, mappingLength); }
+
+        size_t size() const { return nCategories; }
+        const WEIGHT &operator [](size_t index) const { return tree[index]; }
+        WEIGHT &operator [](size_t index) { assert(writable); return tree[index]; }
+
+    protected:
+        void *      mapping;
+        size_t      mappingLength;
+        WEIGHT *    tree;
+        size_t      nCategories;
+        bool        writable;
+
+        friend class MutableCategoricalArraySnapshot<WEIGHT>;
+    };
+
+    typedef MutableCategoricalArray<WEIGHT, MappedTree> mapped_array_type;
+
+    static mapped_array_type map(const std::string &path, MapMode mode = READ_ONLY);
+#endif
+};
+
+
+template<class WEIGHT>
+void MutableCategoricalArraySnapshot<WEIGHT>::Header::validate() const {
+    if(std::memcmp(magic, "MUTCATAR", 8) != 0) throw std::runtime_error("Not a MutableCategoricalArray snapshot");
+    if(version != currentVersion) throw std::runtime_error("Unsupported snapshot version");
+    if(byteOrder != byteOrderMark) throw std::runtime_error("Snapshot was written with a different byte order");
+    if(weightSize != sizeof(WEIGHT) || weightKind != kindOfWeight()) {
+        throw std::runtime_error("Snapshot has a different weight type");
+    }
+    if(nCategories > INT_MAX) throw std::runtime_error("Snapshot has too many categories");
+}
+
+
+template<class WEIGHT>
+template<class STORAGE, class INSTRUMENTATION, bool LEAFWEIGHTS>
+void MutableCategoricalArraySnapshot<WEIGHT>::write(const MutableCategoricalArray<WEIGHT,STORAGE,INSTRUMENTATION,LEAFWEIGHTS> &distribution, std::ostream &out) {
+    Header header(distribution.size());
+    out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    if(distribution.size() > 0) {
+        out.write(reinterpret_cast<const char *>(&distribution.tree[0]), distribution.size() * sizeof(WEIGHT));
+    }
+    if(!out) throw std::runtime_error("Error writing snapshot");
+}
+
+
+template<class WEIGHT>
+MutableCategoricalArray<WEIGHT> MutableCategoricalArraySnapshot<WEIGHT>::read(std::istream &in) {
+    Header header;
+    if(!in.read(reinterpret_cast<char *>(&header), sizeof(Header))) throw std::runtime_error("Error reading snapshot header");
+    header.validate();
+    MutableCategoricalArray<WEIGHT> distribution;
+    // read a chunk at a time, so a truncated snapshot fails before we allocate the whole tree
+    const size_t chunkSize = size_t(1) << 20;
+    for(size_t chunkStart = 0; chunkStart < header.nCategories; chunkStart += chunkSize) {
+        size_t chunkLength = std::min<size_t>(chunkSize, header.nCategories - chunkStart);
+        distribution.tree.resize(chunkStart + chunkLength);
+        if(!in.read(reinterpret_cast<char *>(distribution.tree.data() + chunkStart), chunkLength * sizeof(WEIGHT))) {
+            throw std::runtime_error("Error reading snapshot tree");
+        }
+    }
+    distribution.indexHighestBit = distribution.highestOneBit(header.nCategories - 1);
+    return distribution;
+}
+
+
+// The nodes whose subtrees contain the next index are the path from the root to it, so
+// are on the stack of open nodes (as in MutableCategoricalArray::setMany()). When the next
+// index is pushed, nodes whose subtrees don't contain it are complete, so are written and
+// their sums added to their parents.
+template<class WEIGHT>
+void MutableCategoricalArraySnapshot<WEIGHT>::Writer::push_back(WEIGHT weight) {
+    assert(!closed);
+    int index = nCategories++;
+    while(!openNodes.empty() && !MutableCategoricalArray<WEIGHT>::subtreeContains(openNodes.back().index, index)) closeTopNode();
+    if(buffer.size() == bufferSize) flushBuffer();
+    buffer.push_back(0); // placeholder until the node is complete
+    openNodes.push_back(OpenNode{index, weight, 0});
+}
+
+template<class WEIGHT>
+void MutableCategoricalArraySnapshot<WEIGHT>::Writer::close() {
+    if(closed) return;
+    while(!openNodes.empty()) closeTopNode();
+    flushBuffer();
+    std::streampos end = out.tellp();
+    Header header(nCategories);
+    out.seekp(start);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    out.seekp(end);
+    closed = true;
+    if(!out) throw std::runtime_error("Error writing snapshot");
+}
+
+// sums are calculated in the same order as MutableCategoricalArray's build, so are identical
+template<class WEIGHT>
+void MutableCategoricalArraySnapshot<WEIGHT>::Writer::closeTopNode() {
+    OpenNode node = openNodes.back();
+    openNodes.pop_back();
+    WEIGHT value = node.descendantSum + node.weight;
+    writeNode(node.index, value);
+    if(!openNodes.empty()) openNodes.back().descendantSum += value;
+}
+
+template<class WEIGHT>
+void MutableCategoricalArraySnapshot<WEIGHT>::Writer::writeNode(int index, WEIGHT value) {
+    if(index >= bufferStart) {
+        buffer[index - bufferStart] = value;
+    } else { // already flushed
+        std::streampos end = out.tellp();
+        out.seekp(start + std::streamoff(sizeof(Header) + index * sizeof(WEIGHT)));
+        out.write(reinterpret_cast<const char *>(&value), sizeof(WEIGHT));
+        out.seekp(end);
+    }
+}
+
+template<class WEIGHT>
+void MutableCategoricalArraySnapshot<WEIGHT>::Writer::flushBuffer() {
+    out.write(reinterpret_cast<const char *>(buffer.data()), buffer.size() * sizeof(WEIGHT));
+    bufferStart += buffer.size();
+    buffer.clear();
+}
+
+
+#if defined(__unix__) || defined(__APPLE__)
+template<class WEIGHT>
+typename MutableCategoricalArraySnapshot<WEIGHT>::mapped_array_type
+MutableCategoricalArraySnapshot<WEIGHT>::map(const std::string &path, MapMode mode) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1) throw std::runtime_error("Can't open snapshot " + path);
+    struct stat fileStatus;
+    if(fstat(fd, &fileStatus) != 0 || fileStatus.st_size < sizeof(Header)) {
+        ::close(fd);
+        throw std::runtime_error("Snapshot " + path + " is too short");
+    }
+    MappedTree tree;
+    tree.mappingLength = fileStatus.st_size;
+    tree.writable = (mode == COPY_ON_WRITE);
+    void *mapping = mmap(nullptr, tree.mappingLength,
+                         tree.writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                         tree.writable ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file open
+    if(mapping == MAP_FAILED) throw std::runtime_error("Can't map snapshot " + path);
+    tree.mapping = mapping;
+
+    const Header &header = *static_cast<const Header *>(mapping);
+    header.validate();
+    if(header.nCategories > (tree.mappingLength - sizeof(Header)) / sizeof(WEIGHT)) {
+        throw std::runtime_error("Snapshot " + path + " is too short");
+    }
+    tree.tree = reinterpret_cast<WEIGHT *>(static_cast<char *>(mapping) + sizeof(Header));
+    tree.nCategories = header.nCategories;
+
+    mapped_array_type distribution;
+    distribution.tree = std::move(tree);
+    distribution.indexHighestBit = distribution.highestOneBit(header.nCategories - 1);
+    return distribution;
+}
+#endif
+
+#endif //CPP_MUTABLECATEGORICALARRAYSNAPSHOT_H
@@ -0,0 +1,255 @@
+// This class has the same interface as MutableCategoricalArray, and the same tree layout,
+// but allows draws and calls to set() to be made concurrently from any number of threads
+// without locks.
+//
+// Each node of the tree is a std::atomic and set() propagates the change in weight to
+// the node and its ancestors with atomic additions. Every addition is applied exactly once
+// however the additions from different threads interleave, so with integer weights the tree
+// always ends up with the correct sums. Floating point additions applied in different orders
+// round differently, so with floating point weights the sums may differ from the sums of the
+// weights by rounding error, as they do in MutableCategoricalArray after a sequence of set()s.
+// The weights of the categories are also stored separately, and set() swaps in the new
+// weight atomically to find the change, so concurrent calls to set() on the same index behave
+// as though they were made in some order. Draws only read the tree, so never block or wait
+// for a writer.
+//
+// Consistency: a draw that doesn't overlap any call to set() has exactly the distribution
+// given by the weights, as for MutableCategoricalArray. A draw that overlaps calls to set()
+// may see some nodes of the tree before and some after an in-flight change, so the cumulative
+// weights it uses may each be out by up to D, the sum of the absolute changes in weight being
+// made by the overlapping calls. So the probability of drawing any category differs from its
+// probability under the weights at the start or end of the draw by O(D/sum()). A draw never
+// returns a category whose weight was zero when the draw returned (it's drawn again if so)
+// so, for example, a category that has been set to zero, and whose set() has returned, will
+// never be drawn. Once all calls to set() have returned, get() is exact and sum() and draws
+// are exact up to rounding error.
+//
+// The size of the array is fixed while it's shared between threads: push_back(), pop_back(),
+// reserve() and assignment must not be called concurrently with any other member.
+#ifndef CPP_MUTABLECATEGORICALCONCURRENTARRAY_H
+#define CPP_MUTABLECATEGORICALCONCURRENTARRAY_H
+
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <random>
+#include <ostream>
+#include <vector>
+#include <type_traits>
+
+template<class WEIGHT = double>
+class MutableCategoricalConcurrentArray {
+
+    // This class allows array operator [] syntax for both reading and writing
+    class EntryRef {
+        int i;
+        MutableCategoricalConcurrentArray &p;
+    public:
+
+        EntryRef(int index, MutableCategoricalConcurrentArray &dist): i(index), p(dist) { }
+        operator WEIGHT() const { return p.get(i); }
+        WEIGHT weight() const { return p.get(i); }
+        WEIGHT operator =(WEIGHT weight) { p.set(i, weight); return weight; }
+        WEIGHT operator =(const EntryRef &otherRef) {   // reference assignment semantics
+            WEIGHT w_i = otherRef.weight();
+            p.set(i, w_i); return w_i; }
+    };
+
+    std::unique_ptr<std::atomic<WEIGHT>[]> tree;
+    std::unique_ptr<std::atomic<WEIGHT>[]> weights;
+    int nCategories;
+    int capacity;
+    int indexHighestBit;
+
+public:
+
+    MutableCategoricalConcurrentArray(): nCategories(0), capacity(0), indexHighestBit(0) { }
+
+    MutableCategoricalConcurrentArray(int size): MutableCategoricalConcurrentArray() {
+        build(std::vector<WEIGHT>(size, 0));
+    }
+
+    MutableCategoricalConcurrentArray(int size, std::function<WEIGHT(int)> init): MutableCategoricalConcurrentArray() {
+        std::vector<WEIGHT> values(size);
+        for(int i=0; i<size; ++i) values[i] = init(i);
+        build(values);
+    }
+
+    MutableCategoricalConcurrentArray(std::initializer_list<WEIGHT> values): MutableCategoricalConcurrentArray() {
+        build(std::vector<WEIGHT>(values));
+    }
+
+    template<typename ITERATOR,
+            typename std::enable_if<
+                    std::is_convertible<
+                            typename std::iterator_traits<ITERATOR>::iterator_category,
+                            std::input_iterator_tag
+                    >::value, int
+            >::type = 0>
+    MutableCategoricalConcurrentArray(ITERATOR begin, ITERATOR end): MutableCategoricalConcurrentArray() {
+        build(std::vector<WEIGHT>(begin, end));
+    }
+
+    MutableCategoricalConcurrentArray(const MutableCategoricalConcurrentArray &other): MutableCategoricalConcurrentArray() {
+        *this = other;
+    }
+
+    MutableCategoricalConcurrentArray &operator =(const MutableCategoricalConcurrentArray &other) {
+        std::vector<WEIGHT> values(other.size());
+        for(int i=0; i<other.size(); ++i) values[i] = other.get(i);
+        build(values);
+        return *this;
+    }
+
+
+    size_t size() const { return nCategories; }
+
+    void reserve(size_t n) { if(n > capacity) reallocate(n); }
+
+    // add a new category with index size(). Not thread safe.
+    void push_back(WEIGHT weight) {
+        if(nCategories == capacity) reallocate(capacity == 0 ? 16 : 2 * capacity);
+        int newIndex = nCategories++;
+        tree[newIndex].store(0, std::memory_order_relaxed);
+        weights[newIndex].store(0, std::memory_order_relaxed);
+        indexHighestBit = highestOneBit(newIndex);
+        // the new node is the root of a subtree containing only itself, since any
+        // descendants would have higher indices, so its sum is just its weight
+        set(newIndex, weight);
+    }
+
+    // remove the highest index category. Not thread safe.
+    void pop_back() {
+        set(nCategories - 1, 0);
+        --nCategories;
+        indexHighestBit = highestOneBit(nCategories - 1);
+    }
+
+    // sets the weight associated with the supplied index
+    EntryRef operator [](int index) { return EntryRef(index, *this); }
+
+    // returns the weight of the supplied index.
+    WEIGHT operator [](int index) const { return get(index); }
+
+    // gets the weight associated with an index
+    WEIGHT get(int index) const { return weights[index].load(std::memory_order_relaxed); }
+
+    // sets the weight associated with an index. May be called concurrently with any
+    // other calls to set() or draws.
+    void set(int index, WEIGHT weight) {
+        WEIGHT delta = weight - weights[index].exchange(weight, std::memory_order_relaxed);
+        if(delta == 0) return;
+        atomicAdd(tree[index], delta);
+        // ancestors are found by clearing the lowest set bit
+        while(index != 0) {
+            index &= index - 1;
+            atomicAdd(tree[index], delta);
+        }
+    }
+
+    // draws a sample from the distribution in proportion to the weights, or returns -1 if no
+    // category has weight
+    template<typename RNG> int operator()(RNG &generator) const;
+
+    // the sum of all weights (doesn't need to be 1.0)
+    WEIGHT sum() const { return nCategories == 0 ? 0 : tree[0].load(std::memory_order_relaxed); }
+
+    // Returns the normalised probability of the index'th element
+    double P(int index) const { return static_cast<double>(get(index)) / sum(); }
+
+    friend std::ostream &operator <<(std::ostream &out, const MutableCategoricalConcurrentArray &distribution) {
+        for(int i=0; i<distribution.size(); ++i) {
+            out << distribution[i] << " ";
+        }
+        return out;
+    }
+
+protected:
+
+    // atomic fetch_add for floating point types isn't available until C++20
+    static void atomicAdd(std::atomic<WEIGHT> &node, WEIGHT delta) {
+        if constexpr (std::is_integral<WEIGHT>::value) {
+            node.fetch_add(delta, std::memory_order_relaxed);
+        } else {
+            WEIGHT oldSum = node.load(std::memory_order_relaxed);
+            while(!node.compare_exchange_weak(oldSum, oldSum + delta, std::memory_order_relaxed)) { }
+        }
+    }
+
+    // sets the weights and builds the tree, using the same layout as MutableCategoricalArray,
+    // in O(N) time. Not thread safe.
+    void build(const std::vector<WEIGHT> &values) {
+        nCategories = 0;
+        reallocate(values.size());
+        nCategories = values.size();
+        indexHighestBit = highestOneBit(nCategories - 1);
+        std::vector<WEIGHT> sums(values);
+        for(int i = nCategories - 1; i > 0; --i) sums[i & (i - 1)] += sums[i];
+        for(int i = 0; i < nCategories; ++i) {
+            tree[i].store(sums[i], std::memory_order_relaxed);
+            weights[i].store(values[i], std::memory_order_relaxed);
+        }
+    }
+
+    // moves the tree to new storage with the given capacity. Not thread safe.
+    void reallocate(int newCapacity) {
+        std::unique_ptr<std::atomic<WEIGHT>[]> newTree(new std::atomic<WEIGHT>[newCapacity]);
+        std::unique_ptr<std::atomic<WEIGHT>[]> newWeights(new std::atomic<WEIGHT>[newCapacity]);
+        for(int i = 0; i < nCategories; ++i) {
+            newTree[i].store(tree[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            newWeights[i].store(weights[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        tree = std::move(newTree);
+        weights = std::move(newWeights);
+        capacity = newCapacity;
+    }
+
+    static constexpr int maxConsecutiveRedraws = 64;
+
+    typedef typename std::conditional<std::is_integral<WEIGHT>::value,
+            std::uniform_int_distribution<WEIGHT>,
+            std::uniform_real_distribution<WEIGHT>>::type uniform_distribution_type;
+
+    static int highestOneBit(int i) {
+        i = i | (i >> 1);
+        i = i | (i >> 2);
+        i = i | (i >> 4);
+        i = i | (i >> 8);
+        i = i | (i >> 16);
+        return i - (i >> 1);
+    }
+};
+
+
+// The same descent as MutableCategoricalArray, but repeated if the category drawn has
+// zero weight. This can happen if the draw overlapped a call to set(), or if rounding error
+// has left sum() positive when all weights are zero (or the target in the range of a zero
+// weight category), so we give up after maxConsecutiveRedraws and return -1.
+template<class WEIGHT>
+template<typename RNG>
+int MutableCategoricalConcurrentArray<WEIGHT>::operator()(RNG &generator) const {
+    for(int nRedraws = 0; nRedraws < maxConsecutiveRedraws; ++nRedraws) {
+        WEIGHT total = sum();
+        if(!(total > 0)) return -1;
+        WEIGHT target;
+        if constexpr (std::is_integral<WEIGHT>::value) {
+            target = uniform_distribution_type(0, total - 1)(generator);
+        } else {
+            target = uniform_distribution_type(0, total)(generator);
+        }
+        int index = 0;
+        int rightChildOffset = indexHighestBit;
+        while(rightChildOffset != 0) {
+            int childIndex = index + rightChildOffset;
+            if(childIndex < nCategories) {
+                WEIGHT childSum = tree[childIndex].load(std::memory_order_relaxed);
+                if(childSum > target) index = childIndex; else target -= childSum;
+            }
+            rightChildOffset = rightChildOffset >> 1;
+        }
+        if(get(index) != 0) return index;
+    }
+    return -1;
+}
+
+#endif //CPP_MUTABLECATEGORICALCONCURRENTARRAY_H
@@ -0,0 +1,230 @@
+// A two-level categorical distribution: items are divided into groups, and a draw chooses a
+// group with probability in proportion to the total weight of its items, then an item in the
+// group in proportion to its weight, which is the same as drawing an item in proportion to its
+// weight from all items. This is useful when the groups mean something (e.g. spatial cells
+// or blocks of agents) so that we also want to draw from a single group, or to know the
+// total weight of a group.
+//
+// Items are identified by integer ids, returned by add(), which stay the same when an item
+// is moved to another group. set() and get() modify and read an item's weight in O(log(n))
+// time and move() moves an item to another group in O(log(n)) time.
+//
+// Each group's weights are held in a MutableCategoricalArray and the groups' totals in an
+// outer MutableCategoricalArray, which is updated whenever a group changes, so the group totals
+// are always consistent with the items' weights. The trees of all groups share one contiguous
+// arena: each group's tree is a slice of the arena, which is moved to the end of the arena
+// (like a std::vector) when the group outgrows it. The abandoned slices are reclaimed by
+// compact(), which is called automatically once they take up half the arena, and which
+// also puts the groups back into order of group id.
+//
+// Item ids of erased items are not reused.
+#ifndef CPP_MUTABLECATEGORICALGROUPS_H
+#define CPP_MUTABLECATEGORICALGROUPS_H
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <vector>
+#include "MutableCategoricalArray.h"
+
+template<class WEIGHT = double>
+class MutableCategoricalGroups {
+public:
+
+    // The contiguous storage shared by the trees of all groups
+    struct Arena {
+        std::vector<WEIGHT> data;
+        size_t              nAbandoned = 0;   // number of elements in slices no longer used by any group
+    };
+
+    // A STORAGE for MutableCategoricalArray that lives in a slice [offset, offset+capacity())
+    // of an Arena. Elements are addressed through the arena, so stay valid when the arena
+    // grows.
+    class ArenaSlice {
+    public:
+        static constexpr size_t minCapacity = 4;
+
+        ArenaSlice(): arena(nullptr), offset(0), nElements(0), nAllocated(0) { }
+
+        WEIGHT &operator[](size_t i) { return arena->data[offset + i]; }
+        const WEIGHT &operator[](size_t i) const { return arena->data[offset + i]; }
+        size_t size() const { return nElements; }
+        size_t capacity() const { return nAllocated; }
+
+        void push_back(WEIGHT weight) {
+            if(nElements == nAllocated) reallocate(std::max(minCapacity, 2 * nAllocated));
+            arena->data[offset + nElements++] = weight;
+        }
+
+        void pop_back() { --nElements; }
+
+        void reserve(size_t n) { if(n > nAllocated) reallocate(n); }
+
+    protected:
+        // moves to a new slice at the end of the arena or, if we're already at the end, extends
+        void reallocate(size_t newCapacity) {
+            if(offset + nAllocated == arena->data.size()) {
+                arena->data.resize(offset + newCapacity);
+            } else {
+                size_t newOffset = arena->data.size();
+                arena->data.resize(newOffset + newCapacity);
+                std::copy(arena->data.begin() + offset, arena->data.begin() + offset + nElements, arena->data.begin() + newOffset);
+                arena->nAbandoned += nAllocated;
+                offset = newOffset;
+            }
+            nAllocated = newCapacity;
+        }
+
+        Arena * arena;
+        size_t  offset;
+        size_t  nElements;
+        size_t  nAllocated;
+
+        friend class MutableCategoricalGroups<WEIGHT>;
+    };
+
+    // The distribution over the items in one group, indexed by position in the group
+    typedef MutableCategoricalArray<WEIGHT, ArenaSlice> group_type;
+
+    explicit MutableCategoricalGroups(int nGroups = 0): arena(new Arena()) {
+        for(int g = 0; g < nGroups; ++g) addGroup();
+    }
+
+    // adds a new, empty, group and returns its id
+    int addGroup() {
+        groups.emplace_back();
+        groups.back().tree.arena = arena.get();
+        members.emplace_back();
+        groupTotals.push_back(0);
+        return groups.size() - 1;
+    }
+
+    // adds an item with the given weight to group and returns its id
+    int add(int group, WEIGHT weight) {
+        int item = locations.size();
+        locations.push_back({-1, -1});
+        insert(item, group, weight);
+        return item;
+    }
+
+    // removes an item
+    void erase(int item) {
+        remove(item);
+        locations[item].group = -1;
+    }
+
+    // moves an item, keeping its weight, to another group
+    void move(int item, int newGroup) {
+        if(newGroup == locations[item].group) return;
+        WEIGHT weight = get(item);
+        remove(item);
+        insert(item, newGroup, weight);
+    }
+
+    // sets the weight of an item
+    void set(int item, WEIGHT weight) {
+        Location location = locations[item];
+        groups[location.group].set(location.position, weight);
+        updateGroupTotal(location.group);
+    }
+
+    WEIGHT get(int item) const {
+        Location location = locations[item];
+        return groups[location.group][location.position];
+    }
+    WEIGHT operator [](int item) const { return get(item); }
+
+    // the group of an item, or -1 if it has been erased
+    int group(int item) const { return locations[item].group; }
+
+    // the items in a group (in no particular order)
+    const std::vector<int> &itemsIn(int group) const { return members[group]; }
+
+    int nGroups() const { return groups.size(); }
+
+    // the sum of the weights of the items in a group, in O(1) time
+    WEIGHT groupSum(int group) const { return groups[group].sum(); }
+
+    // the sum of the weights of all items
+    WEIGHT sum() const { return groupTotals.sum(); }
+
+    double P(int item) const { return static_cast<double>(get(item)) / sum(); }
+
+    // Draws an item in proportion to its weight, or returns -1 if there are no items with weight.
+    // Rounding error can leave an empty group with a tiny total in the outer tree, so a draw
+    // of a group with no weight is redrawn.
+    template<typename RNG> int operator()(RNG &generator) const {
+        for(int nRedraws = 0; nRedraws < maxConsecutiveRedraws && sum() > 0; ++nRedraws) {
+            int group = sampleGroup(generator);
+            if(groupSum(group) > 0) return sampleInGroup(generator, group);
+        }
+        return -1;
+    }
+
+    // draws a group in proportion to its sum
+    template<typename RNG> int sampleGroup(RNG &generator) const { return groupTotals(generator); }
+
+    // draws an item from a group, which must have non-zero sum, in proportion to its weight
+    template<typename RNG> int sampleInGroup(RNG &generator, int group) const { return members[group][groups[group](generator)]; }
+
+    // Moves the trees of all groups to a new arena, in order of group, leaving out the slices
+    // abandoned by groups that have grown, in O(N) time
+    void compact() {
+        size_t nElements = 0;
+        for(const group_type &group: groups) nElements += group.tree.nAllocated;
+        std::vector<WEIGHT> compacted(nElements);
+        size_t offset = 0;
+        for(group_type &group: groups) {
+            ArenaSlice &slice = group.tree;
+            std::copy(arena->data.begin() + slice.offset, arena->data.begin() + slice.offset + slice.nElements, compacted.begin() + offset);
+            slice.offset = offset;
+            offset += slice.nAllocated;
+        }
+        arena->data.swap(compacted);
+        arena->nAbandoned = 0;
+    }
+
+    // the number of elements in the arena, including abandoned and unused capacity
+    size_t arenaSize() const { return arena->data.size(); }
+
+protected:
+    static constexpr int maxConsecutiveRedraws = 64;
+
+    struct Location {
+        int group;      // -1 if the item has been erased
+        int position;   // index in the group's tree
+    };
+
+    void insert(int item, int group, WEIGHT weight) {
+        locations[item] = {group, static_cast<int>(groups[group].size())};
+        members[group].push_back(item);
+        groups[group].push_back(weight);
+        updateGroupTotal(group);
+        if(arena->nAbandoned > arena->data.size() / 2) compact();
+    }
+
+    // removes an item from its group by moving the group's last item into its position
+    void remove(int item) {
+        int g = locations[item].group;
+        int position = locations[item].position;
+        int lastItem = members[g].back();
+        if(lastItem != item) {
+            groups[g].set(position, groups[g][members[g].size() - 1]);
+            members[g][position] = lastItem;
+            locations[lastItem].position = position;
+        }
+        groups[g].pop_back();
+        members[g].pop_back();
+        updateGroupTotal(g);
+    }
+
+    void updateGroupTotal(int group) { groupTotals.set(group, groups[group].sum()); }
+
+    std::unique_ptr<Arena>              arena;          // on the heap, so slices stay valid when this is moved
+    std::vector<group_type>             groups;
+    std::vector<std::vector<int>>       members;        // members[g][p] is the item at position p of group g
+    MutableCategoricalArray<WEIGHT>     groupTotals;
+    std::vector<Location>               locations;      // by item id
+};
+
+#endif //CPP_MUTABLECATEGORICALGROUPS_H
@@ -0,0 +1,84 @@
+// Instrumentation policies for MutableCategoricalArray, MutableCategorical and
+// MutableCategoricalMap, which take the policy as their last template parameter, e.g.
+//
+// MutableCategoricalMap<int, std::allocator<int>, false, CountingInstrumentation> map;
+//
+// NoInstrumentation, the default, has only empty inline members and no data, so an
+// uninstrumented build compiles to the same code and has the same size as if there were no
+// instrumentation. CountingInstrumentation counts draws and updates, and the number of tree
+// nodes they visit, in relaxed atomic counters, so concurrent draws from a const distribution
+// are still safe.
+//
+// stats() on any of the classes returns a MutableCategoricalStats snapshot of the counts,
+// along with the expected depth of a draw and the memory footprint, which are calculated
+// when stats() is called, so are available whatever the policy.
+#ifndef CPP_MUTABLECATEGORICALINSTRUMENTATION_H
+#define CPP_MUTABLECATEGORICALINSTRUMENTATION_H
+
+#include <atomic>
+#include <cstddef>
+
+struct MutableCategoricalStats {
+    long    nSamples = 0;               // number of draws (a batch of n draws counts as n)
+    long    nUpdates = 0;               // number of weight changes, insertions and removals
+    long    sampleNodesVisited = 0;     // total number of tree nodes read by draws
+    long    updateNodesVisited = 0;     // total number of tree nodes read or written by updates
+    double  expectedDepth = 0.0;        // expected number of levels of the tree that a draw descends
+    double  huffmanDepth = 0.0;         // expected depth of the optimal (Huffman) tree (MutableCategoricalMap only)
+    size_t  memoryBytes = 0;            // memory held by the distribution, including unused capacity
+
+    double meanSampleNodesVisited() const { return nSamples == 0 ? 0.0 : static_cast<double>(sampleNodesVisited) / nSamples; }
+    double meanUpdateNodesVisited() const { return nUpdates == 0 ? 0.0 : static_cast<double>(updateNodesVisited) / nUpdates; }
+};
+
+
+class NoInstrumentation {
+public:
+    static constexpr bool enabled = false;
+
+    void recordSamples(long /*nSamples*/, long /*nodesVisited*/) const { }
+    void recordUpdates(long /*nUpdates*/, long /*nodesVisited*/) const { }
+    void addCounts(MutableCategoricalStats &/*stats*/) const { }
+};
+
+
+class CountingInstrumentation {
+public:
+    static constexpr bool enabled = true;
+
+    CountingInstrumentation() = default;
+    CountingInstrumentation(const CountingInstrumentation &other) { *this = other; }
+
+    CountingInstrumentation &operator =(const CountingInstrumentation &other) {
+        nSamples.store(other.nSamples.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        nUpdates.store(other.nUpdates.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        sampleNodesVisited.store(other.sampleNodesVisited.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        updateNodesVisited.store(other.updateNodesVisited.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void recordSamples(long n, long nodesVisited) const {
+        nSamples.fetch_add(n, std::memory_order_relaxed);
+        sampleNodesVisited.fetch_add(nodesVisited, std::memory_order_relaxed);
+    }
+
+    void recordUpdates(long n, long nodesVisited) const {
+        nUpdates.fetch_add(n, std::memory_order_relaxed);
+        updateNodesVisited.fetch_add(nodesVisited, std::memory_order_relaxed);
+    }
+
+    void addCounts(MutableCategoricalStats &stats) const {
+        stats.nSamples += nSamples.load(std::memory_order_relaxed);
+        stats.nUpdates += nUpdates.load(std::memory_order_relaxed);
+        stats.sampleNodesVisited += sampleNodesVisited.load(std::memory_order_relaxed);
+        stats.updateNodesVisited += updateNodesVisited.load(std::memory_order_relaxed);
+    }
+
+protected:
+    mutable std::atomic<long> nSamples{0};
+    mutable std::atomic<long> nUpdates{0};
+    mutable std::atomic<long> sampleNodesVisited{0};
+    mutable std::atomic<long> updateNodesVisited{0};
+};
+
+#endif //CPP_MUTABLECATEGORICALINSTRUMENTATION_H
@@ -0,0 +1,254 @@
+// This class has the same interface as MutableCategoricalArray, representing a categorical
+// probability distribution over an integer range 0..N where each integer is associated with
+// a weight, w_i, and a probability given by
+//
+// P(i) = w_i / \sum_j w_j
+//
+// but internally the weights are stored in a B-ary sum tree rather than a binary one.
+// Each node of the tree holds, for each of its B children, the cumulative sum of the weights
+// of that child and all children to its left. With B=8 a node is exactly one 64-byte cache
+// line, so sampling touches only log_B(N) cache lines, compared to log_2(N) for the binary
+// layout, which makes a big difference once the tree no longer fits in cache.
+//
+// A sample chooses a child at each level by counting the number of cumulative sums that are
+// less than or equal to the target, which is done with SIMD compare and movemask instructions
+// (AVX if available, otherwise SSE2). Modifying a weight adds the change in weight to the
+// cumulative sums to the right of the modified child in each node on the path to the root,
+// so runs in O(B log_B(N)) time, but the additions within a node are also vectorised.
+//
+// Nodes are stored level by level, leaves first, with node n at level l having children
+// nB...nB+B-1 at level l-1. Children beyond the end of the array have zero weight.
+#ifndef CPP_MUTABLECATEGORICALKARYARRAY_H
+#define CPP_MUTABLECATEGORICALKARYARRAY_H
+
+#include <functional>
+#include <random>
+#include <ostream>
+#include <vector>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+template<int B = 8>
+class MutableCategoricalKaryArray {
+    static_assert(B % 4 == 0, "Branching factor must be a multiple of the SIMD width");
+
+    // This class allows array operator [] syntax for both reading and writing
+    class EntryRef {
+        int i;
+        MutableCategoricalKaryArray<B> &p;
+    public:
+
+        EntryRef(int index, MutableCategoricalKaryArray<B> &dist): i(index), p(dist) { }
+        operator double() const { return p.get(i); }
+        double weight() const { return p.get(i); }
+        double operator =(double weight) { p.set(i, weight); return weight; }
+        double operator =(const EntryRef &otherRef) {   // reference assignment semantics
+            double w_i = otherRef.weight();
+            p.set(i, w_i); return w_i; }
+    };
+
+    struct alignas(64) Node {
+        double cumulativeSum[B];
+
+        double total() const { return cumulativeSum[B-1]; }
+        double weight(int child) const { return child == 0 ? cumulativeSum[0] : cumulativeSum[child] - cumulativeSum[child-1]; }
+        int countLessOrEqual(double target) const;
+        void addFrom(int child, double delta);
+    };
+
+    std::vector<std::vector<Node>> levels; // levels[0] are the leaves, levels.back() is the root
+    int nCategories;
+
+public:
+
+    MutableCategoricalKaryArray(): nCategories(0) { }
+
+    MutableCategoricalKaryArray(int size): nCategories(size) {
+        resizeLevels();
+    }
+
+    MutableCategoricalKaryArray(int size, std::function<double(int)> init): nCategories(size) {
+        build(init);
+    }
+
+    MutableCategoricalKaryArray(std::initializer_list<double> values): nCategories(values.size()) {
+        build([&values](int i) { return values.begin()[i]; });
+    }
+
+    template<typename ITERATOR,
+            typename std::enable_if<
+                    std::is_convertible<
+                            typename std::iterator_traits<ITERATOR>::iterator_category,
+                            std::input_iterator_tag
+                    >::value, int
+            >::type = 0>
+    MutableCategoricalKaryArray(ITERATOR begin, ITERATOR end) {
+        std::vector<double> values(begin, end);
+        nCategories = values.size();
+        build([&values](int i) { return values[i]; });
+    }
+
+
+    size_t size() const { return nCategories; }
+
+    void reserve(size_t n) { if(!levels.empty()) levels[0].reserve((n + B - 1)/B); }
+
+    // add a new category with index size()
+    void push_back(double weight) {
+        ++nCategories;
+        resizeLevels();
+        set(nCategories - 1, weight);
+    }
+
+    // remove the highest index category.
+    void pop_back() {
+        set(nCategories - 1, 0.0);
+        --nCategories;
+        resizeLevels();
+    }
+
+    // sets the weight associated with the supplied index
+    EntryRef operator [](int index) { return EntryRef(index, *this); }
+
+    // returns the weight of the supplied index.
+    double operator [](int index) const { return get(index); }
+
+    // gets the weight associated with an index
+    double get(int index) const { return levels[0][index / B].weight(index % B); }
+
+    // sets the weight associated with an index
+    void set(int index, double weight) {
+        double delta = weight - get(index);
+        for(std::vector<Node> &level: levels) {
+            level[index / B].addFrom(index % B, delta);
+            index /= B;
+        }
+    }
+
+    // draws a sample from the distribution in proportion to the weights
+    template<typename RNG> int operator()(RNG &generator) const;
+
+    // the sum of all weights (doesn't need to be 1.0)
+    double sum() const { return levels.empty() ? 0.0 : levels.back()[0].total(); }
+
+    // Returns the normalised probability of the index'th element
+    double P(int index) const { return get(index) / sum(); }
+
+    friend std::ostream &operator <<(std::ostream &out, const MutableCategoricalKaryArray<B> &distribution) {
+        for(int i=0; i<distribution.size(); ++i) {
+            out << distribution[i] << " ";
+        }
+        return out;
+    }
+
+protected:
+
+    // builds the tree from the weights of categories 0..size()-1 in O(N) time
+    template<class WEIGHTS>
+    void build(const WEIGHTS &weightOf) {
+        levels.clear();
+        resizeLevels();
+        if(levels.empty()) return;
+        for(int node = 0; node < levels[0].size(); ++node) {
+            double cumulativeSum = 0.0;
+            for(int child = 0; child < B; ++child) {
+                int index = node * B + child;
+                if(index < nCategories) cumulativeSum += weightOf(index);
+                levels[0][node].cumulativeSum[child] = cumulativeSum;
+            }
+        }
+        for(int l = 1; l < levels.size(); ++l) {
+            for(int node = 0; node < levels[l].size(); ++node) initNode(l, node);
+        }
+    }
+
+    // Adds or removes nodes at the end of each level so that there are enough leaves for
+    // size() categories and a single root. New nodes have zero weight, except for a new root,
+    // whose first child is the old root. Removed nodes must have zero weight.
+    void resizeLevels() {
+        if(nCategories == 0) {
+            levels.clear();
+            return;
+        }
+        size_t nNodes = (nCategories + B - 1) / B;
+        size_t l = 0;
+        while(true) {
+            if(l == levels.size()) levels.emplace_back();
+            std::vector<Node> &level = levels[l];
+            if(level.size() > nNodes) level.resize(nNodes);
+            while(level.size() < nNodes) {
+                level.emplace_back();
+                initNode(l, level.size() - 1);
+            }
+            if(nNodes == 1) break;
+            nNodes = (nNodes + B - 1) / B;
+            ++l;
+        }
+        levels.resize(l + 1);
+    }
+
+    // sets the cumulative sums of a node from the totals of its children on the level below
+    // (or to zero if it's a leaf)
+    void initNode(int l, int node) {
+        double cumulativeSum = 0.0;
+        for(int child = 0; child < B; ++child) {
+            int childNode = node * B + child;
+            if(l > 0 && childNode < levels[l-1].size()) cumulativeSum += levels[l-1][childNode].total();
+            levels[l][node].cumulativeSum[child] = cumulativeSum;
+        }
+    }
+};
+
+
+template<int B>
+template<typename RNG>
+int MutableCategoricalKaryArray<B>::operator()(RNG &generator) const {
+    double target = std::uniform_real_distribution<double>(0.0, sum())(generator);
+    int index = 0;
+    for(int l = levels.size() - 1; l >= 0; --l) {
+        const Node &node = levels[l][index];
+        int child = node.countLessOrEqual(target);
+        if(child == B) { // rounding error has put target beyond the last child, so take the last non-zero child
+            child = B - 1;
+            while(child > 0 && node.weight(child) == 0.0) --child;
+        }
+        if(child > 0) target -= node.cumulativeSum[child-1];
+        index = index * B + child;
+    }
+    return index;
+}
+
+
+// Since cumulative sums are non-decreasing, the number of sums less than or equal to
+// target is the index of the child that target falls in.
+template<int B>
+int MutableCategoricalKaryArray<B>::Node::countLessOrEqual(double target) const {
+    int count = 0;
+#if defined(__AVX__)
+    __m256d targets = _mm256_set1_pd(target);
+    for(int child = 0; child < B; child += 4) {
+        __m256d sums = _mm256_load_pd(cumulativeSum + child);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(sums, targets, _CMP_LE_OQ)));
+    }
+#elif defined(__SSE2__)
+    __m128d targets = _mm_set1_pd(target);
+    for(int child = 0; child < B; child += 2) {
+        __m128d sums = _mm_load_pd(cumulativeSum + child);
+        count += __builtin_popcount(_mm_movemask_pd(_mm_cmple_pd(sums, targets)));
+    }
+#else
+    for(int child = 0; child < B; ++child) count += (cumulativeSum[child] <= target);
+#endif
+    return count;
+}
+
+
+// adds delta to the cumulative sums of child and all children to its right.
+// Written without branches so the compiler can vectorise it.
+template<int B>
+void MutableCategoricalKaryArray<B>::Node::addFrom(int child, double delta) {
+    for(int i = 0; i < B; ++i) cumulativeSum[i] += (i >= child) ? delta : 0.0;
+}
+
+#endif //CPP_MUTABLECATEGORICALKARYARRAY_H
@@ -13,17 +13,50 @@
 // using category.setWeight(), or a category can be drawn at random using the
 // call operator (), all in O(log(N)) time.
 // The sum of all weights can be accessed in O(1) time using sum()
+//
+// A map can also be built in one go from a range of (value, weight) pairs, either as a
+// Huffman tree, which minimises the expected depth of a sample, in O(N log(N)) time using
+// createHuffmanTree(), or as a minimal depth binary tree in O(N) time using createBinaryTree().
+//
+// If ROTATE is true (see MutableCategoricalMapWithRotation) the tree rebalances itself
+// whenever sums are updated, by rotating nodes so as to stay close to the optimal (Huffman)
+// expected depth as weights change. Rotations (and the swapping of children to keep the
+// heavier child on the left) reorder the leaves, so in rotating mode the order of iteration,
+// and so prefixSum() and findByCumulative(), can change whenever a weight is set or a category
+// is added or erased. Iterators stay valid until their category is erased, but an iteration
+// must not be interleaved with modifications, and the iterator returned by erase() is the
+// category that followed the erased one before the tree was rebalanced, which isn't necessarily
+// the next category in the new order. To erase while iterating, first collect the iterators
+// to erase, then erase them.
+//
+// Tree nodes are allocated from pools of memory slabs obtained from an allocator of type ALLOC
+// (std::allocator by default) which can optionally be passed to the constructor. So, adding and
+// erasing categories doesn't usually call the allocator, nodes created at similar times are
+// close together in memory and clear() takes O(number of slabs) time if T is trivially destructible.
+//
+// Draws and updates can be counted by giving an INSTRUMENTATION policy (see
+// MutableCategoricalInstrumentation.h). Updates are counted by set(), add() and erase(), but
+// not by calling setWeight() on a category directly. stats() also compares the expected depth
+// of a draw with that of the optimal Huffman tree of the current weights, which shows how far
+// the tree has drifted from optimal, in O(N log(N)) time.
 #ifndef CPP_MUTABLECATEGORICALMAP_H
 #define CPP_MUTABLECATEGORICALMAP_H
 
 #include <assert.h>
-#include <deque>
 #include <random>
-
-template<class T>
-class MutableCategoricalMap {
+#include <type_traits>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <ostream>
+#include "NodePool.h"
+#include "HuffmanLength.h"
+#include "MutableCategoricalInstrumentation.h"
+
+template<class T, class ALLOC = std::allocator<T>, bool ROTATE = false, class INSTRUMENTATION = NoInstrumentation>
+class MutableCategoricalMap: protected INSTRUMENTATION {
 protected:
-    static std::mt19937 random;
+    static thread_local std::mt19937 random;
 
     class SumTreeNode {
     public:
@@ -37,7 +70,8 @@ protected:
         {}
 
         bool isLeaf() const { return leftChild == nullptr; }
-        void updateSum() { sum = leftChild->sum + rightChild->sum; }
+        void updateSum();
+        void rotate();
 
         SumTreeNode *siblingOf(const SumTreeNode &child) const {
             assert(&child == leftChild || &child == rightChild);
@@ -53,7 +87,7 @@ protected:
             }
         }
 
-        void updateAncestorSums();
+        int updateAncestorSums();
 
     };
 
@@ -93,7 +127,7 @@ public:
         void setWeight(double w) { this->sum = w; this->updateAncestorSums(); }
         operator T() { return value; }
         operator const T() const { return value; }
-        friend class MutableCategoricalMap<T>;
+        friend class MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>;
 
     protected:
         SumTreeNode *nodePtr() { return this; }
@@ -104,39 +138,100 @@ public:
     typedef iterator_base<Category>         iterator;
     typedef iterator_base<const Category>   const_iterator;
 
-    MutableCategoricalMap(): rootNode(nullptr), nCategories(0) {
+    explicit MutableCategoricalMap(const ALLOC &allocator = ALLOC()):
+        rootNode(nullptr), nCategories(0), sumNodePool(allocator), categoryPool(allocator) {
+    }
+
+    enum TreeType {
+        BINARY_TREE,
+        HUFFMAN_TREE
+    };
+
+    // creates a map from a range of std::pair<T,double> (value, weight) pairs, built as the given type of tree
+    template<class ITERATOR>
+    MutableCategoricalMap(ITERATOR begin, ITERATOR end, TreeType treeType = BINARY_TREE, const ALLOC &allocator = ALLOC()):
+        MutableCategoricalMap(allocator) {
+        if(treeType == HUFFMAN_TREE) createHuffmanTree(begin, end); else createBinaryTree(begin, end);
     }
 
     ~MutableCategoricalMap() { clear(); }
 
+    template<class ITERATOR> void createHuffmanTree(ITERATOR begin, ITERATOR end);
+    template<class ITERATOR> void createBinaryTree(ITERATOR begin, ITERATOR end);
+
     iterator add(const T &categoryValue, double probability);
     iterator erase(const_iterator category);
     template<typename RNG = decltype(random)> iterator operator ()(RNG &randomGenerator=random) { return choose<iterator>(*this, randomGenerator); }
     template<typename RNG = decltype(random)> const_iterator operator()(RNG &randomGenerator=random) const { return choose<const_iterator>(*this, randomGenerator); }
+    // Draws up to k distinct categories without replacement (i.e. each draw is from the distribution
+    // with the previously drawn categories removed), writing iterators to them to out in order of
+    // drawing, in O(k log(N)) time without modifying the tree.
+    template<typename RNG, typename OUTPUTITERATOR>
+    OUTPUTITERATOR sampleDistinct(RNG &randomGenerator, size_t k, OUTPUTITERATOR out) { return chooseDistinct<iterator>(*this, randomGenerator, k, out); }
+    template<typename RNG, typename OUTPUTITERATOR>
+    OUTPUTITERATOR sampleDistinct(RNG &randomGenerator, size_t k, OUTPUTITERATOR out) const { return chooseDistinct<const_iterator>(*this, randomGenerator, k, out); }
+    // Draws a category as if excluded had zero weight, in O(depth) time without modifying the
+    // tree, or returns end() if no other category has weight.
+    template<typename RNG>
+    iterator sampleExcluding(RNG &randomGenerator, const_iterator excluded) { return chooseExcluding<iterator>(*this, randomGenerator, excluded); }
+    template<typename RNG>
+    const_iterator sampleExcluding(RNG &randomGenerator, const_iterator excluded) const { return chooseExcluding<const_iterator>(*this, randomGenerator, excluded); }
+    // The inverse of the cumulative distribution, in order of iteration: returns the category
+    // whose range of cumulative weight, [prefixSum(category), prefixSum(category) + weight),
+    // contains cumulativeWeight, for 0 <= cumulativeWeight < sum(). quantile(u) does the same
+    // for u in [0,1) of the normalised distribution, and quantiles() for a sorted range of u's,
+    // visiting each node of the tree at most once.
+    iterator findByCumulative(double cumulativeWeight) { return find<iterator>(*this, cumulativeWeight); }
+    const_iterator findByCumulative(double cumulativeWeight) const { return find<const_iterator>(*this, cumulativeWeight); }
+    iterator quantile(double u) { return find<iterator>(*this, u * sum()); }
+    const_iterator quantile(double u) const { return find<const_iterator>(*this, u * sum()); }
+    template<typename RANDOMACCESSITERATOR, typename OUTPUTITERATOR>
+    OUTPUTITERATOR quantiles(RANDOMACCESSITERATOR begin, RANDOMACCESSITERATOR end, OUTPUTITERATOR out) {
+        return rootNode == nullptr ? out : findSorted<iterator>(*this, rootNode, 0.0, begin, end, out);
+    }
+    template<typename RANDOMACCESSITERATOR, typename OUTPUTITERATOR>
+    OUTPUTITERATOR quantiles(RANDOMACCESSITERATOR begin, RANDOMACCESSITERATOR end, OUTPUTITERATOR out) const {
+        return rootNode == nullptr ? out : findSorted<const_iterator>(*this, rootNode, 0.0, begin, end, out);
+    }
+    // the sum of the weights of the categories before category in order of iteration, in O(depth) time
+    double prefixSum(const_iterator category) const;
     double sum() const { return (rootNode == nullptr)?0.0:rootNode->sum; }
     double probability(const_iterator category) const { return category->getWeight()/sum(); }
     static double weight(const_iterator category) { return category->getWeight(); }
-    static void set(iterator category, double weight) { category->setWeight(weight); }
+    void set(iterator category, double weight) {
+        SumTreeNode *leaf = category->nodePtr();
+        leaf->sum = weight;
+        this->recordUpdates(1, 1 + leaf->updateAncestorSums());
+    }
     iterator begin();
     iterator end();
     const_iterator begin() const;
     const_iterator end() const;
     void clear();
     int  size() { return nCategories; }
+    double expectedDepth() const;
+    MutableCategoricalStats stats() const;
 
 //    friend std::ostream &operator <<(std::ostream &out, const MutableCategorical<T> &mutableCategorical);
 
 protected:
     SumTreeNode *   rootNode;
     int             nCategories;
+    NodePool<SumTreeNode, ALLOC>    sumNodePool;
+    NodePool<Category, ALLOC>       categoryPool;
 
-    void insert(SumTreeNode &newNode, SumTreeNode &insertionPoint);
+    int insert(SumTreeNode &newNode, SumTreeNode &insertionPoint);
+    SumTreeNode *createParent(SumTreeNode *child1, SumTreeNode *child2);
     template<class R, class V, class G> static R choose(V &distribution, G &randomGenerator);
+    template<class R, class V> static R find(V &distribution, double cumulativeWeight);
+    template<class R, class V, class I, class O> static O findSorted(V &distribution, SumTreeNode *node, double nodeStart, I begin, I end, O out);
+    template<class R, class V, class G, class O> static O chooseDistinct(V &distribution, G &randomGenerator, size_t k, O out);
+    template<class R, class V, class G> static R chooseExcluding(V &distribution, G &randomGenerator, const_iterator excluded);
 };
 
-template<class T>
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
 template<class V>
-typename MutableCategoricalMap<T>::template iterator_base<V> &MutableCategoricalMap<T>::iterator_base<V>::operator++() {
+typename MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::template iterator_base<V> &MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::iterator_base<V>::operator++() {
     if(ptr == nullptr) return *this;
     auto currentNode = ptr->nodePtr();
     while(currentNode->parent != nullptr && currentNode->parent->rightChild == currentNode) {
@@ -157,9 +252,10 @@ typename MutableCategoricalMap<T>::template iterator_base<V> &MutableCategorical
 
 // navigate down the tree, taking always the lower sum child until sum is less than
 // the probability to add, or we reach a leaf.
-template<class T>
-typename MutableCategoricalMap<T>::iterator MutableCategoricalMap<T>::add(const T &categoryValue, double probability) {
-    Category *newLeaf = new Category(categoryValue, nullptr, probability);
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+typename MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::iterator MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::add(const T &categoryValue, double probability) {
+    Category *newLeaf = categoryPool.create(categoryValue, nullptr, probability);
+    int nodesVisited = 1;
     if(rootNode == nullptr) {
         rootNode = newLeaf;
     } else {
@@ -170,47 +266,156 @@ typename MutableCategoricalMap<T>::iterator MutableCategoricalMap<T>::add(const
             } else {
                 currentNode = currentNode->rightChild;
             }
+            ++nodesVisited;
         }
-        insert(*newLeaf, *currentNode);
+        nodesVisited += insert(*newLeaf, *currentNode);
     }
+    this->recordUpdates(1, nodesVisited);
     ++nCategories;
     return iterator(newLeaf);
 }
 
 // inserts newNode at insertionPoint by creating a new sum node whose children are the new
 // node (right child) and the insertion point (left child) and whose parent is the original
-// parent of insertionPoint
-template<class T>
-void MutableCategoricalMap<T>::insert(SumTreeNode &newNode, SumTreeNode &insertionPoint) {
-    SumTreeNode *newParent = new SumTreeNode(insertionPoint.parent, &insertionPoint, &newNode, insertionPoint.sum + newNode.sum);
+// parent of insertionPoint. Returns the number of sum nodes created or updated.
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+int MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::insert(SumTreeNode &newNode, SumTreeNode &insertionPoint) {
+    SumTreeNode *newParent = sumNodePool.create(insertionPoint.parent, &insertionPoint, &newNode, insertionPoint.sum + newNode.sum);
     insertionPoint.parent = newParent;
     newNode.parent = newParent;
+    if constexpr (ROTATE) newParent->updateSum(); // order the children and rebalance
     if(newParent->parent == nullptr) {
         rootNode = newParent;
-    } else {
-        newParent->parent->updateChild(&insertionPoint, newParent);
-        newParent->updateAncestorSums();
+        return 1;
+    }
+    newParent->parent->updateChild(&insertionPoint, newParent);
+    return 1 + newParent->updateAncestorSums();
+}
+
+
+// Clears this map and sets it to be the Huffman tree of the given (value, weight) pairs,
+// by repeatedly joining the two lowest weight nodes. Once the leaves are sorted by weight,
+// new parents are created in order of increasing weight, so the two lowest weight nodes are
+// always at the front of either the sorted leaves or the queue of parents.
+// This runs in O(N log(N)) time.
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+template<class ITERATOR>
+void MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::createHuffmanTree(ITERATOR begin, ITERATOR end) {
+    clear();
+    std::vector<std::pair<double, SumTreeNode *>> leaves;
+    for(; begin != end; ++begin) {
+        leaves.emplace_back(begin->second, categoryPool.create(begin->first, nullptr, begin->second)->nodePtr());
+        ++nCategories;
+    }
+    if(leaves.empty()) return;
+    std::sort(leaves.begin(), leaves.end(), [](const std::pair<double, SumTreeNode *> &a, const std::pair<double, SumTreeNode *> &b) {
+        return a.first < b.first;
+    });
+    std::vector<SumTreeNode *> parents;
+    parents.reserve(leaves.size() - 1);
+    size_t nextLeaf = 0;
+    size_t nextParent = 0;
+    auto popLowest = [&]() {
+        if(nextParent == parents.size() || (nextLeaf < leaves.size() && leaves[nextLeaf].first <= parents[nextParent]->sum)) {
+            return leaves[nextLeaf++].second;
+        }
+        return parents[nextParent++];
+    };
+    for(size_t nJoins = 1; nJoins < leaves.size(); ++nJoins) {
+        SumTreeNode *first = popLowest();
+        SumTreeNode *second = popLowest();
+        parents.push_back(createParent(first, second));
+    }
+    rootNode = parents.empty() ? leaves[0].second : parents.back();
+}
+
+// Clears this map and sets it to be a binary tree of the given (value, weight) pairs
+// with minimal depth, by joining nodes in first-in-first-out order. This runs in O(N) time.
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+template<class ITERATOR>
+void MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::createBinaryTree(ITERATOR begin, ITERATOR end) {
+    clear();
+    std::vector<SumTreeNode *> queue;
+    for(; begin != end; ++begin) {
+        queue.push_back(categoryPool.create(begin->first, nullptr, begin->second));
+        ++nCategories;
+    }
+    size_t head = 0;
+    while(queue.size() - head > 1) {
+        SumTreeNode *first = queue[head++];
+        SumTreeNode *second = queue[head++];
+        queue.push_back(createParent(first, second));
+    }
+    rootNode = queue.empty() ? nullptr : queue.back();
+}
+
+// creates a new parent for two root nodes, with the higher weight child on the left.
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+typename MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::SumTreeNode *MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::createParent(SumTreeNode *child1, SumTreeNode *child2) {
+    if(child1->sum < child2->sum) std::swap(child1, child2);
+    SumTreeNode *parent = sumNodePool.create(nullptr, child1, child2, child1->sum + child2->sum);
+    child1->parent = parent;
+    child2->parent = parent;
+    return parent;
+}
+
+
+// In rotating mode, the children are ordered so that the left child has the higher weight,
+// and the node is rotated while that reduces the expected depth of the tree.
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+void MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::SumTreeNode::updateSum() {
+    sum = leftChild->sum + rightChild->sum;
+    if constexpr (ROTATE) {
+        if(leftChild->sum < rightChild->sum) std::swap(leftChild, rightChild);
+        while(!leftChild->isLeaf() && rightChild->sum < leftChild->leftChild->sum) rotate();
     }
 }
 
+// Transforms the subtree (LL,LR),R into LL,(LR,R), which moves LL up a level and R down a
+// level, so reduces the expected depth if LL has a higher weight than R. To keep this node
+// at the top of the subtree, the node of the left child is reused as the new right child.
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+void MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::SumTreeNode::rotate() {
+    SumTreeNode *oldLeft = leftChild;
+    leftChild = oldLeft->leftChild;
+    leftChild->parent = this;
+    oldLeft->leftChild = oldLeft->rightChild;
+    oldLeft->rightChild = rightChild;
+    rightChild->parent = oldLeft;
+    rightChild = oldLeft;
+    oldLeft->sum = oldLeft->leftChild->sum + oldLeft->rightChild->sum;
+    if(oldLeft->leftChild->sum < oldLeft->rightChild->sum) std::swap(oldLeft->leftChild, oldLeft->rightChild);
+    if(leftChild->sum < rightChild->sum) std::swap(leftChild, rightChild);
+}
 
-template<class T>
-void MutableCategoricalMap<T>::SumTreeNode::updateAncestorSums() {
+// returns the number of ancestors updated
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+int MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::SumTreeNode::updateAncestorSums() {
+    int nUpdated = 0;
     SumTreeNode *currentNode = parent;
     while(currentNode != nullptr) {
         currentNode->updateSum();
         currentNode = currentNode->parent;
+        ++nUpdated;
     }
+    return nUpdated;
 }
 
 
 
-template<class T>
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
 template<class R, class V, class G>
-R MutableCategoricalMap<T>::choose(V &distribution, G &randomGenerator) {
+R MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::choose(V &distribution, G &randomGenerator) {
+    if(distribution.rootNode == nullptr) return distribution.end();
+    return find<R>(distribution, std::uniform_real_distribution<double>()(randomGenerator) * distribution.rootNode->sum);
+}
+
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+template<class R, class V>
+R MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::find(V &distribution, double target) {
     if(distribution.rootNode == nullptr) return distribution.end();
-    double target = std::uniform_real_distribution<double>()(randomGenerator) * distribution.rootNode->sum;
     SumTreeNode *currentNode = distribution.rootNode;
+    long nodesVisited = 0;
     while(!currentNode->isLeaf()) {
         if (currentNode->leftChild->sum > target) {
             currentNode = currentNode->leftChild;
@@ -218,18 +423,116 @@ R MutableCategoricalMap<T>::choose(V &distribution, G &randomGenerator) {
             target -= currentNode->leftChild->sum;
             currentNode = currentNode->rightChild;
         }
+        ++nodesVisited;
     }
+    distribution.recordSamples(1, nodesVisited);
     return R(static_cast<Category *>(currentNode));
 }
 
+// Each sorted range of u's is split between the children of a node at the first u whose
+// cumulative weight is beyond the left child.
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+template<class R, class V, class I, class O>
+O MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::findSorted(V &distribution, SumTreeNode *node, double nodeStart, I begin, I end, O out) {
+    if(node->isLeaf()) {
+        distribution.recordSamples(end - begin, 0);
+        for(; begin != end; ++begin) *out++ = R(static_cast<Category *>(node));
+        return out;
+    }
+    double rightStart = nodeStart + node->leftChild->sum;
+    double total = distribution.rootNode->sum;
+    I split = std::partition_point(begin, end, [rightStart, total](double u) { return u * total < rightStart; });
+    distribution.recordSamples(0, 1);
+    if(split != begin) out = findSorted<R>(distribution, node->leftChild, nodeStart, begin, split, out);
+    if(split != end) out = findSorted<R>(distribution, node->rightChild, rightStart, split, end, out);
+    return out;
+}
+
+// Each ancestor of which the category is under the right child adds its left child's sum
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+double MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::prefixSum(const_iterator category) const {
+    double sum = 0.0;
+    const SumTreeNode *node = category->nodePtr();
+    for(const SumTreeNode *parent = node->parent; parent != nullptr; node = parent, parent = node->parent) {
+        if(parent->rightChild == node) sum += parent->leftChild->sum;
+    }
+    return sum;
+}
+
+// The weights of drawn categories are subtracted from the sums of the nodes on their paths to
+// the root in a temporary overlay, as in MutableCategoricalArray::sampleDistinct(). A drawn
+// category's leaf has exactly zero remaining weight, so if rounding error leads to one, we
+// draw again, giving up if only rounding error is left.
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+template<class R, class V, class G, class O>
+O MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::chooseDistinct(V &distribution, G &randomGenerator, size_t k, O out) {
+    const int maxConsecutiveRedraws = 64;
+    std::unordered_map<const SumTreeNode *, double> drawnWeight;
+    auto remainingSum = [&drawnWeight](const SumTreeNode *node) {
+        auto drawnEntry = drawnWeight.find(node);
+        return drawnEntry == drawnWeight.end() ? node->sum : node->sum - drawnEntry->second;
+    };
+    size_t nDrawn = 0;
+    int nRedraws = 0;
+    while(nDrawn < k && distribution.rootNode != nullptr && nRedraws < maxConsecutiveRedraws) {
+        double total = remainingSum(distribution.rootNode);
+        if(total <= 0.0) break;
+        double target = std::uniform_real_distribution<double>()(randomGenerator) * total;
+        SumTreeNode *currentNode = distribution.rootNode;
+        long nodesVisited = 0;
+        while(!currentNode->isLeaf()) {
+            double leftSum = remainingSum(currentNode->leftChild);
+            if (leftSum > target) {
+                currentNode = currentNode->leftChild;
+            } else {
+                target -= leftSum;
+                currentNode = currentNode->rightChild;
+            }
+            ++nodesVisited;
+        }
+        distribution.recordSamples(1, nodesVisited);
+        double weight = remainingSum(currentNode);
+        if(weight <= 0.0) {
+            ++nRedraws;
+            continue;
+        }
+        nRedraws = 0;
+        ++nDrawn;
+        *out++ = R(static_cast<Category *>(currentNode));
+        for(const SumTreeNode *node = currentNode; node != nullptr; node = node->parent) drawnWeight[node] += weight;
+    }
+    return out;
+}
+
+// Draws a cumulative weight from the total of the other categories and, if it's beyond the
+// start of excluded, skips over the weight of excluded. If rounding error leads to excluded,
+// or to a zero weight category, we draw again.
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+template<class R, class V, class G>
+R MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::chooseExcluding(V &distribution, G &randomGenerator, const_iterator excluded) {
+    const int maxConsecutiveRedraws = 64;
+    double excludedWeight = excluded->getWeight();
+    double excludedStart = distribution.prefixSum(excluded);
+    double total = distribution.sum() - excludedWeight;
+    if(!(total > 0.0)) return distribution.end();
+    for(int nRedraws = 0; nRedraws < maxConsecutiveRedraws; ++nRedraws) {
+        double target = std::uniform_real_distribution<double>()(randomGenerator) * total;
+        if(target >= excludedStart) target += excludedWeight;
+        R category = find<R>(distribution, target);
+        if(category.ptr != excluded.ptr && category->getWeight() > 0.0) return category;
+    }
+    return distribution.end();
+}
+
 // remove a given category by removing the parent of the category and
 // replacing it with its sibling. Returns an iterator pointing to the
-// element after the one removed.
-template<class T>
-typename MutableCategoricalMap<T>::iterator MutableCategoricalMap<T>::erase(MutableCategoricalMap<T>::const_iterator categoryIt) {
+// element after the one removed (before rebalancing, in rotating mode).
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+typename MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::iterator MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::erase(MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::const_iterator categoryIt) {
     iterator nextIterator(const_cast<Category *>(categoryIt.ptr));
     ++nextIterator;
     SumTreeNode *parentToRemove = categoryIt->parent;
+    int nodesVisited = 1;
     if(parentToRemove == nullptr) {
         rootNode = nullptr;
     } else {
@@ -239,67 +542,102 @@ typename MutableCategoricalMap<T>::iterator MutableCategoricalMap<T>::erase(Muta
             rootNode = sibling;
         } else {
             parentToRemove->parent->updateChild(parentToRemove, sibling);
-            sibling->updateAncestorSums();
+            nodesVisited += 1 + sibling->updateAncestorSums();
         }
-        delete(parentToRemove);
+        sumNodePool.destroy(parentToRemove);
     }
-    delete(categoryIt.ptr);
+    categoryPool.destroy(const_cast<Category *>(categoryIt.ptr));
     --nCategories;
+    this->recordUpdates(1, nodesVisited);
     return nextIterator;
 }
 
-template<class T>
-typename MutableCategoricalMap<T>::iterator MutableCategoricalMap<T>::begin() {
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+typename MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::iterator MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::begin() {
     if(rootNode == nullptr) return iterator(nullptr);
     SumTreeNode *currentNode = rootNode;
     while(!currentNode->isLeaf()) currentNode = currentNode->leftChild;
     return iterator(static_cast<Category *>(currentNode));
 }
 
-template<class T>
-typename MutableCategoricalMap<T>::iterator MutableCategoricalMap<T>::end() {
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+typename MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::iterator MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::end() {
     return MutableCategoricalMap::iterator(nullptr);
 }
 
-template<class T>
-typename MutableCategoricalMap<T>::const_iterator MutableCategoricalMap<T>::begin() const {
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+typename MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::const_iterator MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::begin() const {
     if(rootNode == nullptr) return const_iterator(nullptr);
     SumTreeNode *currentNode = rootNode;
     while(!currentNode->isLeaf()) currentNode = currentNode->leftChild;
     return const_iterator(static_cast<const Category *>(currentNode));
 }
 
-template<class T>
-typename MutableCategoricalMap<T>::const_iterator MutableCategoricalMap<T>::end() const {
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+typename MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::const_iterator MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::end() const {
     return MutableCategoricalMap::const_iterator(nullptr);
 }
 
 
-template<class T>
-void MutableCategoricalMap<T>::clear() {
-    if(rootNode == nullptr) return;
-    std::deque<SumTreeNode *> nodesToDelete;
-    nodesToDelete.push_back(rootNode);
-    while(!nodesToDelete.empty()) {
-        SumTreeNode *nextNodeToDelete = nodesToDelete.front();
-        nodesToDelete.pop_front();
-        if(!nextNodeToDelete->isLeaf()) {
-            nodesToDelete.push_back(nextNodeToDelete->leftChild);
-            nodesToDelete.push_back(nextNodeToDelete->rightChild);
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+void MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::clear() {
+    if constexpr (!std::is_trivially_destructible<T>::value) {
+        iterator it = begin();
+        while(it != end()) {
+            Category &category = *it++;
+            category.~Category();
         }
-        delete(nextNodeToDelete);
     }
+    sumNodePool.release();
+    categoryPool.release();
     rootNode = nullptr;
+    nCategories = 0;
+}
+
+// The expected number of steps from the root to a sampled leaf. This is the sum of the
+// weights of all internal nodes divided by the total weight. (This is calcHuffmanLength()
+// in the Kotlin version)
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+double MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::expectedDepth() const {
+    if(rootNode == nullptr) return 0.0;
+    double internalSum = 0.0;
+    std::vector<const SumTreeNode *> nodesToVisit = {rootNode};
+    while(!nodesToVisit.empty()) {
+        const SumTreeNode *node = nodesToVisit.back();
+        nodesToVisit.pop_back();
+        if(!node->isLeaf()) {
+            internalSum += node->sum;
+            nodesToVisit.push_back(node->leftChild);
+            nodesToVisit.push_back(node->rightChild);
+        }
+    }
+    return internalSum / rootNode->sum;
+}
+
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+MutableCategoricalStats MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::stats() const {
+    MutableCategoricalStats stats;
+    this->addCounts(stats);
+    stats.expectedDepth = expectedDepth();
+    std::vector<double> weights;
+    weights.reserve(nCategories);
+    for(const Category &category: *this) weights.push_back(category.getWeight());
+    stats.huffmanDepth = calcHuffmanLength(weights.begin(), weights.end());
+    stats.memoryBytes = sizeof(*this) + sumNodePool.memoryBytes() + categoryPool.memoryBytes();
+    return stats;
 }
 
-template<class T>
-std::ostream &operator<<(std::ostream &out, const MutableCategoricalMap<T> &mutableCategorical) {
-    for(const typename MutableCategoricalMap<T>::Category &category : mutableCategorical) {
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION>
+std::ostream &operator<<(std::ostream &out, const MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION> &mutableCategorical) {
+    for(const typename MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::Category &category : mutableCategorical) {
         out << category.value << " -> " << category.getWeight() << std::endl;
     }
     return out;
 }
 
-template<class T> std::mt19937 MutableCategoricalMap<T>::random;
+template<class T, class ALLOC, bool ROTATE, class INSTRUMENTATION> thread_local std::mt19937 MutableCategoricalMap<T,ALLOC,ROTATE,INSTRUMENTATION>::random;
+
+template<class T, class ALLOC = std::allocator<T>, class INSTRUMENTATION = NoInstrumentation>
+using MutableCategoricalMapWithRotation = MutableCategoricalMap<T, ALLOC, true, INSTRUMENTATION>;
 
 #endif //CPP_MUTABLECATEGORICALMAP_H
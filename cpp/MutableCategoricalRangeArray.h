@@ -0,0 +1,270 @@
+// This class has the basic interface of MutableCategoricalArray<double> (construction, get(),
+// set(), operator [], push_back(), pop_back(), draws, sum() and P()), representing a categorical
+// probability distribution over an integer range 0..N where each integer is associated with
+// a weight, w_i, and a probability given by
+//
+// P(i) = w_i / \sum_j w_j
+//
+// but also allows all weights in an index range [begin,end) to be changed at once in
+// O(log(N)) time, whatever the length of the range, using
+//
+//     addRange(begin, end, delta)      w_i -> w_i + delta
+//     scaleRange(begin, end, factor)   w_i -> w_i * factor
+//
+// and the sum of the weights in a range to be read with rangeSum(begin, end) in O(log(N)) time.
+//
+// Internally this is a segment tree with lazy propagation: a complete binary tree, stored
+// as a heap (node n has children 2n and 2n+1, the root is node 1 and leaf i is node
+// capacity+i) where each internal node holds the sum of its subtree and a pending affine
+// tag, w -> scale*w + shift, which is still to be applied to every weight in its children's
+// subtrees. A range update tags the O(log(N)) nodes that exactly cover the range, and
+// only tags on the path to an individual weight are pushed down when it is set. Draws and
+// get() don't push tags down, but compose the tags of the ancestors as they descend, so they
+// are const and stay correct while tags are pending.
+//
+// This takes about four doubles per category (a sum for each node and a tag for each internal
+// node) rather than the one of MutableCategoricalArray, so use it only if range updates are
+// needed. Weights must stay non-negative. Weights are always doubles (scaleRange() multiplies
+// by a real factor) and there's no setAll(), setMany() or batched sample().
+#ifndef CPP_MUTABLECATEGORICALRANGEARRAY_H
+#define CPP_MUTABLECATEGORICALRANGEARRAY_H
+
+#include <functional>
+#include <random>
+#include <ostream>
+#include <vector>
+#include <cassert>
+
+class MutableCategoricalRangeArray {
+
+    // This class allows array operator [] syntax for both reading and writing
+    class EntryRef {
+        int i;
+        MutableCategoricalRangeArray &p;
+    public:
+
+        EntryRef(int index, MutableCategoricalRangeArray &dist): i(index), p(dist) { }
+        operator double() const { return p.get(i); }
+        double weight() const { return p.get(i); }
+        double operator =(double weight) { p.set(i, weight); return weight; }
+        double operator =(const EntryRef &otherRef) {   // reference assignment semantics
+            double w_i = otherRef.weight();
+            p.set(i, w_i); return w_i; }
+    };
+
+    // the affine map w -> scale*w + shift on each weight
+    struct Tag {
+        double scale;
+        double shift;
+
+        bool isIdentity() const { return scale == 1.0 && shift == 0.0; }
+
+        // the map that applies inner then this
+        Tag after(const Tag &inner) const { return {scale * inner.scale, scale * inner.shift + shift}; }
+
+        // the sum of length weights whose sum was sum, after the map
+        double mapSum(double sum, int length) const { return scale * sum + shift * length; }
+    };
+
+    static constexpr Tag identity = {1.0, 0.0};
+
+    std::vector<double> sums;       // sum of each node's subtree, excluding the tags of its ancestors
+    std::vector<Tag>    tags;       // tag of each internal node, pending for its children
+    int                 capacity;   // number of leaves, a power of two
+    int                 nLevels;    // log2(capacity), the number of levels of internal nodes
+    int                 nCategories;
+
+public:
+
+    MutableCategoricalRangeArray(): MutableCategoricalRangeArray(0) { }
+
+    MutableCategoricalRangeArray(int size): nCategories(size) {
+        build([](int) { return 0.0; });
+    }
+
+    MutableCategoricalRangeArray(int size, std::function<double(int)> init): nCategories(size) {
+        build(init);
+    }
+
+    MutableCategoricalRangeArray(std::initializer_list<double> values): nCategories(values.size()) {
+        build([&values](int i) { return values.begin()[i]; });
+    }
+
+    template<typename ITERATOR,
+            typename std::enable_if<
+                    std::is_convertible<
+                            typename std::iterator_traits<ITERATOR>::iterator_category,
+                            std::input_iterator_tag
+                    >::value, int
+            >::type = 0>
+    MutableCategoricalRangeArray(ITERATOR begin, ITERATOR end) {
+        std::vector<double> values(begin, end);
+        nCategories = values.size();
+        build([&values](int i) { return values[i]; });
+    }
+
+
+    size_t size() const { return nCategories; }
+
+    void reserve(size_t n) { if(n > static_cast<size_t>(capacity)) rebuild(n); }
+
+    // add a new category with index size()
+    void push_back(double weight) {
+        if(nCategories == capacity) rebuild(2 * capacity);
+        ++nCategories;
+        set(nCategories - 1, weight);
+    }
+
+    // remove the highest index category.
+    void pop_back() {
+        set(nCategories - 1, 0.0);
+        --nCategories;
+    }
+
+    // sets the weight associated with the supplied index
+    EntryRef operator [](int index) { return EntryRef(index, *this); }
+
+    // returns the weight of the supplied index.
+    double operator [](int index) const { return get(index); }
+
+    // gets the weight associated with an index, in O(log(N)) time
+    double get(int index) const {
+        int leaf = capacity + index;
+        Tag ancestorTags = identity;
+        for(int shift = nLevels; shift > 0; --shift) ancestorTags = ancestorTags.after(tags[leaf >> shift]);
+        return ancestorTags.mapSum(sums[leaf], 1);
+    }
+
+    // sets the weight associated with an index, in O(log(N)) time
+    void set(int index, double weight) {
+        int leaf = capacity + index;
+        for(int shift = nLevels; shift > 0; --shift) pushDown(leaf >> shift, 1 << shift);
+        sums[leaf] = weight;
+        for(int node = leaf >> 1; node != 0; node >>= 1) sums[node] = sums[2*node] + sums[2*node + 1];
+    }
+
+    // adds delta to the weights of indices begin...end-1, in O(log(N)) time
+    void addRange(int begin, int end, double delta) {
+        assert(0 <= begin && begin <= end && end <= nCategories);
+        update(1, 0, capacity, begin, end, {1.0, delta});
+    }
+
+    // multiplies the weights of indices begin...end-1 by factor, in O(log(N)) time
+    void scaleRange(int begin, int end, double factor) {
+        assert(0 <= begin && begin <= end && end <= nCategories && factor >= 0.0);
+        update(1, 0, capacity, begin, end, {factor, 0.0});
+    }
+
+    // the sum of the weights of indices begin...end-1, in O(log(N)) time
+    double rangeSum(int begin, int end) const {
+        assert(0 <= begin && begin <= end && end <= nCategories);
+        return rangeSum(1, 0, capacity, begin, end, identity);
+    }
+
+    // draws a sample from the distribution in proportion to the weights
+    template<typename RNG> int operator()(RNG &generator) const;
+
+    // the sum of all weights (doesn't need to be 1.0)
+    double sum() const { return sums[1]; }
+
+    // Returns the normalised probability of the index'th element
+    double P(int index) const { return get(index) / sum(); }
+
+    friend std::ostream &operator <<(std::ostream &out, const MutableCategoricalRangeArray &distribution) {
+        for(size_t i=0; i<distribution.size(); ++i) {
+            out << distribution[i] << " ";
+        }
+        return out;
+    }
+
+protected:
+
+    // builds the tree from the weights of categories 0..size()-1 in O(N) time, with
+    // capacity the smallest power of two not less than size() (and at least 1)
+    template<class WEIGHTS>
+    void build(const WEIGHTS &weightOf) {
+        capacity = 1;
+        nLevels = 0;
+        while(capacity < nCategories) {
+            capacity <<= 1;
+            ++nLevels;
+        }
+        sums.assign(2 * capacity, 0.0);
+        tags.assign(capacity, identity);
+        for(int i = 0; i < nCategories; ++i) sums[capacity + i] = weightOf(i);
+        for(int node = capacity - 1; node != 0; --node) sums[node] = sums[2*node] + sums[2*node + 1];
+    }
+
+    // rebuilds with space for at least newCapacity categories, applying all tags
+    void rebuild(size_t newCapacity) {
+        std::vector<double> weights(nCategories);
+        for(int i = 0; i < nCategories; ++i) weights[i] = get(i);
+        int size = nCategories;
+        nCategories = newCapacity;
+        build([&weights, size](int i) { return i < size ? weights[i] : 0.0; });
+        nCategories = size;
+    }
+
+    // applies tag to all weights in the subtree of node, which has length leaves
+    void apply(int node, int length, const Tag &tag) {
+        sums[node] = tag.mapSum(sums[node], length);
+        if(node < capacity) tags[node] = tag.after(tags[node]);
+    }
+
+    // passes the tag of node, which has length leaves, on to its children
+    void pushDown(int node, int length) {
+        if(tags[node].isIdentity()) return;
+        apply(2*node, length/2, tags[node]);
+        apply(2*node + 1, length/2, tags[node]);
+        tags[node] = identity;
+    }
+
+    // applies tag to the weights in [begin,end) in the subtree of node, which covers [nodeBegin, nodeBegin+length).
+    // Only nodes that lie within [begin,end) are tagged, so the weights beyond size() stay zero.
+    void update(int node, int nodeBegin, int length, int begin, int end, const Tag &tag) {
+        if(end <= nodeBegin || nodeBegin + length <= begin) return;
+        if(begin <= nodeBegin && nodeBegin + length <= end) {
+            apply(node, length, tag);
+            return;
+        }
+        pushDown(node, length);
+        update(2*node, nodeBegin, length/2, begin, end, tag);
+        update(2*node + 1, nodeBegin + length/2, length/2, begin, end, tag);
+        sums[node] = sums[2*node] + sums[2*node + 1];
+    }
+
+    double rangeSum(int node, int nodeBegin, int length, int begin, int end, Tag ancestorTags) const {
+        if(end <= nodeBegin || nodeBegin + length <= begin) return 0.0;
+        if(begin <= nodeBegin && nodeBegin + length <= end) return ancestorTags.mapSum(sums[node], length);
+        ancestorTags = ancestorTags.after(tags[node]);
+        return rangeSum(2*node, nodeBegin, length/2, begin, end, ancestorTags) +
+               rangeSum(2*node + 1, nodeBegin + length/2, length/2, begin, end, ancestorTags);
+    }
+};
+
+
+// Descends from the root, composing the tags of the ancestors to get the true sum of each
+// left child. The right child is only taken if it has positive weight, so rounding error in
+// the target can't choose a zero weight category (or one beyond the end of the array).
+template<typename RNG>
+int MutableCategoricalRangeArray::operator()(RNG &generator) const {
+    double target = std::uniform_real_distribution<double>(0.0, sum())(generator);
+    Tag ancestorTags = identity;
+    int node = 1;
+    int length = capacity;
+    while(node < capacity) {
+        ancestorTags = ancestorTags.after(tags[node]);
+        length >>= 1;
+        int leftChild = 2*node;
+        double leftSum = ancestorTags.mapSum(sums[leftChild], length);
+        if(target < leftSum || !(ancestorTags.mapSum(sums[leftChild + 1], length) > 0.0)) {
+            node = leftChild;
+        } else {
+            target -= leftSum;
+            node = leftChild + 1;
+        }
+    }
+    return node - capacity;
+}
+
+#endif //CPP_MUTABLECATEGORICALRANGEARRAY_H
@@ -0,0 +1,309 @@
+// This class has the same interface as MutableCategoricalArray, representing a categorical
+// probability distribution over an integer range 0..N where each integer is associated with
+// a weight, w_i, and a probability given by
+//
+// P(i) = w_i / \sum_j w_j
+//
+// but both modification and sampling take O(1) expected time, using two levels of grouped
+// rejection sampling (in the style of Matias, Vitter and Ni). Categories are put into groups
+// according to the power of two of their weight, so that the categories in group e have
+// weights in [2^(e-1), 2^e). In the same way, non-empty groups are put into buckets according
+// to the power of two of the sum of their weights. A draw chooses a bucket in proportion to the
+// sum of its groups' sums, then chooses a group in the bucket uniformly and accepts it with
+// probability sum/2^b, then chooses a category in the group uniformly and accepts it with
+// probability w_i/2^e, retrying each choice until it's accepted. Since everything in a bucket
+// or group is at least half its bound, each choice takes fewer than two attempts on average
+// and the result has exactly the distribution given by the weights.
+//
+// Buckets are chosen by scanning the non-empty buckets from the heaviest down, stepping from
+// one to the next with a bitset. There are only a few thousand groups (one per exponent of a
+// double), so the buckets below the k'th non-empty bucket hold less than 2^(13-k) of the total
+// weight, and the expected number of buckets scanned is at most about 14 whatever the size
+// or range of the weights. Modifying a weight moves its category between groups, and each
+// changed group between buckets, in O(1) time, since positions in groups and buckets are
+// recorded and a removed member is replaced with the last member.
+//
+// Weights must be non-negative and finite. Zero weight categories aren't in any group, and
+// a draw returns -1 if no category has weight.
+#ifndef CPP_MUTABLECATEGORICALREJECTIONARRAY_H
+#define CPP_MUTABLECATEGORICALREJECTIONARRAY_H
+
+#include <functional>
+#include <random>
+#include <ostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cassert>
+#include <cstdint>
+
+class MutableCategoricalRejectionArray {
+
+    // This class allows array operator [] syntax for both reading and writing
+    class EntryRef {
+        int i;
+        MutableCategoricalRejectionArray &p;
+    public:
+
+        EntryRef(int index, MutableCategoricalRejectionArray &dist): i(index), p(dist) { }
+        operator double() const { return p.get(i); }
+        double weight() const { return p.get(i); }
+        double operator =(double weight) { p.set(i, weight); return weight; }
+        double operator =(const EntryRef &otherRef) {   // reference assignment semantics
+            double w_i = otherRef.weight();
+            p.set(i, w_i); return w_i; }
+    };
+
+    struct Group {
+        std::vector<int>    members;    // the indices of the categories in this group
+        double              sum = 0.0;  // sum of the weights of the members
+        double              bound;      // upper bound on the weights of the members, 2^e (or DBL_MAX for the top group)
+        int                 bucket = -1;        // the bucket this group is in, or -1 if it's empty
+        int                 positionInBucket;   // position of this group in its bucket's members
+    };
+
+    struct Bucket {
+        std::vector<int>    members;    // the groups whose sums are in [bound/2, bound)
+        double              sum = 0.0;  // sum of the sums of the members
+        double              bound;      // upper bound on the sums of the members, as for groups
+    };
+
+    // Exponents, e, of the upper bounds of the groups (and buckets) for all finite, positive doubles
+    static constexpr int minExponent = DBL_MIN_EXP - DBL_MANT_DIG + 1;
+    static constexpr int maxExponent = DBL_MAX_EXP;
+    static constexpr int nGroups = maxExponent - minExponent + 1;
+    static constexpr int nBitsetWords = (nGroups + 63) / 64;
+    static_assert(nBitsetWords < 64, "the summary of non-empty bitset words must fit in one word");
+
+    std::vector<double> weights;
+    std::vector<int>    positionInGroup;    // position of each category in its group's members
+    std::vector<Group>  groups;             // indexed by e - minExponent
+    std::vector<Bucket> buckets;            // indexed by the exponent of their bound, less minExponent
+    uint64_t            nonEmptyBuckets[nBitsetWords];  // bit b is set if bucket b has members
+    uint64_t            nonEmptyWords;      // bit w is set if nonEmptyBuckets[w] != 0
+    double              total;
+
+public:
+
+    MutableCategoricalRejectionArray(): groups(nGroups), buckets(nGroups), nonEmptyBuckets(), nonEmptyWords(0), total(0.0) {
+        // 2^DBL_MAX_EXP overflows to infinity, but any bound that isn't less than the weights will do
+        for(size_t g = 0; g < groups.size(); ++g) {
+            groups[g].bound = std::min(std::ldexp(1.0, static_cast<int>(g) + minExponent), DBL_MAX);
+            buckets[g].bound = groups[g].bound;
+        }
+    }
+
+    MutableCategoricalRejectionArray(int size): MutableCategoricalRejectionArray() {
+        weights.resize(size, 0.0);
+        positionInGroup.resize(size, -1);
+    }
+
+    MutableCategoricalRejectionArray(int size, std::function<double(int)> init): MutableCategoricalRejectionArray(size) {
+        for(int i=0; i<size; ++i) set(i, init(i));
+    }
+
+    MutableCategoricalRejectionArray(std::initializer_list<double> values): MutableCategoricalRejectionArray(values.begin(), values.end()) { }
+
+    template<typename ITERATOR,
+            typename std::enable_if<
+                    std::is_convertible<
+                            typename std::iterator_traits<ITERATOR>::iterator_category,
+                            std::input_iterator_tag
+                    >::value, int
+            >::type = 0>
+    MutableCategoricalRejectionArray(ITERATOR begin, ITERATOR end): MutableCategoricalRejectionArray() {
+        while(begin != end) push_back(*begin++);
+    }
+
+
+    size_t size() const { return weights.size(); }
+
+    void reserve(size_t n) { weights.reserve(n); positionInGroup.reserve(n); }
+
+    // add a new category with index size()
+    void push_back(double weight) {
+        weights.push_back(0.0);
+        positionInGroup.push_back(-1);
+        set(size()-1, weight);
+    }
+
+    // remove the highest index category.
+    void pop_back() {
+        set(size()-1, 0.0);
+        weights.pop_back();
+        positionInGroup.pop_back();
+    }
+
+    // sets the weight associated with the supplied index
+    EntryRef operator [](int index) { return EntryRef(index, *this); }
+
+    // returns the weight of the supplied index.
+    double operator [](int index) const { return get(index); }
+
+    // gets the weight associated with an index
+    double get(int index) const { return weights[index]; }
+
+    // sets the weight associated with an index
+    void set(int index, double weight);
+
+    // draws a sample from the distribution in proportion to the weights, or returns -1 if no
+    // category has weight
+    template<typename RNG> int operator()(RNG &generator) const;
+
+    // the sum of all weights (doesn't need to be 1.0)
+    double sum() const { return total; }
+
+    // Returns the normalised probability of the index'th element
+    double P(int index) const { return get(index) / sum(); }
+
+    friend std::ostream &operator <<(std::ostream &out, const MutableCategoricalRejectionArray &distribution) {
+        for(size_t i=0; i<distribution.size(); ++i) {
+            out << distribution[i] << " ";
+        }
+        return out;
+    }
+
+protected:
+
+    // the group that a positive weight (or the bucket that a positive sum) belongs to
+    static int groupOf(double weight) {
+        int exponent;
+        std::frexp(weight, &exponent); // weight = m * 2^exponent, with m in [0.5, 1)
+        return exponent - minExponent;
+    }
+
+    void addToGroup(int index, int g);
+    void removeFromGroup(int index, int g);
+    void addToGroupSum(int g, double delta);
+    void setNonEmpty(int b, bool nonEmpty);
+    int nextNonEmptyBucket(int b) const;
+};
+
+
+inline void MutableCategoricalRejectionArray::set(int index, double weight) {
+    assert(weight >= 0.0 && std::isfinite(weight));
+    double oldWeight = weights[index];
+    int oldGroup = oldWeight > 0.0 ? groupOf(oldWeight) : -1;
+    int newGroup = weight > 0.0 ? groupOf(weight) : -1;
+    weights[index] = weight;
+    if(oldGroup == newGroup) {
+        if(newGroup != -1) addToGroupSum(newGroup, weight - oldWeight);
+    } else {
+        if(oldGroup != -1) {
+            removeFromGroup(index, oldGroup);
+            addToGroupSum(oldGroup, -oldWeight);
+        }
+        if(newGroup != -1) {
+            addToGroup(index, newGroup);
+            addToGroupSum(newGroup, weight);
+        }
+    }
+    total += weight - oldWeight;
+    if(nonEmptyWords == 0) total = 0.0; // remove accumulated rounding error
+}
+
+
+inline void MutableCategoricalRejectionArray::addToGroup(int index, int g) {
+    Group &group = groups[g];
+    positionInGroup[index] = group.members.size();
+    group.members.push_back(index);
+}
+
+
+// replaces the removed category with the last member of the group
+inline void MutableCategoricalRejectionArray::removeFromGroup(int index, int g) {
+    Group &group = groups[g];
+    int position = positionInGroup[index];
+    int lastMember = group.members.back();
+    group.members[position] = lastMember;
+    positionInGroup[lastMember] = position;
+    group.members.pop_back();
+    positionInGroup[index] = -1;
+}
+
+
+// updates the sum of a group after a member has been added, removed or modified, and moves
+// the group to the bucket of its new sum, replacing it in its old bucket with the last member
+inline void MutableCategoricalRejectionArray::addToGroupSum(int g, double delta) {
+    Group &group = groups[g];
+    double oldSum = group.sum;
+    group.sum = group.members.empty() ? 0.0 : group.sum + delta; // remove accumulated rounding error
+    int newBucket = group.members.empty() ? -1 : groupOf(group.sum);
+    if(newBucket == group.bucket) {
+        if(newBucket != -1) buckets[newBucket].sum += group.sum - oldSum;
+        return;
+    }
+    if(group.bucket != -1) {
+        Bucket &bucket = buckets[group.bucket];
+        int lastMember = bucket.members.back();
+        bucket.members[group.positionInBucket] = lastMember;
+        groups[lastMember].positionInBucket = group.positionInBucket;
+        bucket.members.pop_back();
+        bucket.sum -= oldSum;
+        if(bucket.members.empty()) {
+            bucket.sum = 0.0;
+            setNonEmpty(group.bucket, false);
+        }
+    }
+    group.bucket = newBucket;
+    if(newBucket != -1) {
+        Bucket &bucket = buckets[newBucket];
+        if(bucket.members.empty()) setNonEmpty(newBucket, true);
+        group.positionInBucket = bucket.members.size();
+        bucket.members.push_back(g);
+        bucket.sum += group.sum;
+    }
+}
+
+
+inline void MutableCategoricalRejectionArray::setNonEmpty(int b, bool nonEmpty) {
+    int word = b / 64;
+    uint64_t bit = uint64_t(1) << (b % 64);
+    if(nonEmpty) nonEmptyBuckets[word] |= bit; else nonEmptyBuckets[word] &= ~bit;
+    if(nonEmptyBuckets[word] != 0) nonEmptyWords |= uint64_t(1) << word; else nonEmptyWords &= ~(uint64_t(1) << word);
+}
+
+
+// the highest non-empty bucket below bucket b (b may be nGroups), or -1 if there is none
+inline int MutableCategoricalRejectionArray::nextNonEmptyBucket(int b) const {
+    int word = b / 64;
+    uint64_t bits = word < nBitsetWords ? nonEmptyBuckets[word] & ((uint64_t(1) << (b % 64)) - 1) : 0;
+    if(bits == 0) {
+        uint64_t words = nonEmptyWords & ((uint64_t(1) << word) - 1);
+        if(words == 0) return -1;
+        word = 63 - __builtin_clzll(words);
+        bits = nonEmptyBuckets[word];
+    }
+    return word * 64 + 63 - __builtin_clzll(bits);
+}
+
+
+template<typename RNG>
+int MutableCategoricalRejectionArray::operator()(RNG &generator) const {
+    int b = nextNonEmptyBucket(nGroups);
+    if(b == -1) return -1;
+    double target = std::uniform_real_distribution<double>(0.0, sum())(generator);
+    for(int next = nextNonEmptyBucket(b); target >= buckets[b].sum && next != -1; next = nextNonEmptyBucket(b)) {
+        target -= buckets[b].sum;
+        b = next;
+    } // if rounding error puts target beyond the last bucket, the last bucket is chosen
+
+    const Bucket &bucket = buckets[b];
+    std::uniform_int_distribution<int> uniformGroup(0, bucket.members.size() - 1);
+    std::uniform_real_distribution<double> uniformSum(0.0, bucket.bound);
+    int g;
+    do {
+        g = bucket.members[uniformGroup(generator)];
+    } while(!(uniformSum(generator) < groups[g].sum));
+
+    const Group &group = groups[g];
+    std::uniform_int_distribution<int> uniformPosition(0, group.members.size() - 1);
+    std::uniform_real_distribution<double> uniformWeight(0.0, group.bound);
+    while(true) {
+        int index = group.members[uniformPosition(generator)];
+        if(uniformWeight(generator) < weights[index]) return index;
+    }
+}
+
+#endif //CPP_MUTABLECATEGORICALREJECTIONARRAY_H
@@ -0,0 +1,96 @@
+//
+// A pool of memory for tree nodes of type NODE.
+//
+// Nodes are carved, in order, out of slabs of memory obtained from ALLOC (which is rebound to
+// the pool's internal block type) so nodes that are created close together in time are
+// close together in memory. Destroyed nodes are put on a free list and their memory is
+// reused, most recently freed first, by subsequent calls to create(). Memory is only returned
+// to ALLOC by release(), or when the pool is destroyed, which takes O(number of slabs) time.
+//
+#ifndef CPP_NODEPOOL_H
+#define CPP_NODEPOOL_H
+
+#include <memory>
+#include <vector>
+#include <utility>
+
+template<class NODE, class ALLOC = std::allocator<NODE>>
+class NodePool {
+protected:
+    union Block {
+        Block *nextFree;
+        alignas(NODE) unsigned char storage[sizeof(NODE)];
+    };
+
+    typedef typename std::allocator_traits<ALLOC>::template rebind_alloc<Block>  block_allocator_type;
+    typedef std::allocator_traits<block_allocator_type>                          block_allocator_traits;
+
+    static constexpr size_t minSlabSize = 64;       // in blocks
+    static constexpr size_t maxSlabSize = 1 << 16;
+
+    block_allocator_type            allocator;
+    std::vector<std::pair<Block *, size_t>> slabs;  // start and size of each slab
+    Block *                         freeList;
+    Block *                         nextUnused;     // next never-used block in the last slab
+    Block *                         slabEnd;
+
+public:
+    explicit NodePool(const ALLOC &alloc = ALLOC()):
+        allocator(alloc), freeList(nullptr), nextUnused(nullptr), slabEnd(nullptr) { }
+
+    NodePool(const NodePool &other) = delete;
+    NodePool &operator =(const NodePool &other) = delete;
+
+    ~NodePool() { release(); }
+
+    // allocates memory for a node and constructs it with the given arguments
+    template<class... ARGS>
+    NODE *create(ARGS &&... args) {
+        Block *block;
+        if(freeList != nullptr) {
+            block = freeList;
+            freeList = freeList->nextFree;
+        } else {
+            if(nextUnused == slabEnd) allocateSlab();
+            block = nextUnused++;
+        }
+        return new(block->storage) NODE(std::forward<ARGS>(args)...);
+    }
+
+    // destructs a node that was created by this pool and puts its memory on the free list
+    void destroy(NODE *node) {
+        node->~NODE();
+        Block *block = reinterpret_cast<Block *>(node);
+        block->nextFree = freeList;
+        freeList = block;
+    }
+
+    // Returns all memory to the allocator without calling the destructors of any nodes
+    // that are still live, so the caller must destroy any nodes that have non-trivial destructors.
+    void release() {
+        for(std::pair<Block *, size_t> &slab: slabs) block_allocator_traits::deallocate(allocator, slab.first, slab.second);
+        slabs.clear();
+        freeList = nullptr;
+        nextUnused = nullptr;
+        slabEnd = nullptr;
+    }
+
+    // the memory obtained from the allocator, in bytes
+    size_t memoryBytes() const {
+        size_t bytes = slabs.capacity() * sizeof(std::pair<Block *, size_t>);
+        for(const std::pair<Block *, size_t> &slab: slabs) bytes += slab.second * sizeof(Block);
+        return bytes;
+    }
+
+protected:
+    // slabs double in size, up to maxSlabSize blocks
+    void allocateSlab() {
+        size_t slabSize = slabs.empty() ? minSlabSize : std::min(2 * slabs.back().second, maxSlabSize);
+        Block *slab = block_allocator_traits::allocate(allocator, slabSize);
+        slabs.emplace_back(slab, slabSize);
+        nextUnused = slab;
+        slabEnd = slab + slabSize;
+    }
+};
+
+#endif //CPP_NODEPOOL_H
@@ -0,0 +1,109 @@
+// A counter-based random number generator, Philox4x32-10 from Salmon, Moraes, Dror and Shaw,
+// "Parallel random numbers: as easy as 1, 2, 3" (SC11), which satisfies the C++
+// UniformRandomBitGenerator requirements so it can be used wherever std::mt19937_64 can.
+//
+// Each output is a function only of the seed, the stream number and the position of the output
+// in the stream: the 128 bit counter (position / 2, stream) is put through ten rounds of the
+// Philox bijection keyed by the seed, giving four 32 bit words, i.e. two 64 bit outputs.
+// So the generator
+//  - holds only a few words of state (rather than the 5 KB of std::mt19937) so there can be
+//    one per thread, per agent or per replicate of a simulation,
+//  - gives 2^64 independent streams per seed, so parallel simulations are reproducible whatever
+//    the order in which threads run, by giving each simulation its own stream,
+//  - can seek to any position in a stream in O(1) time with seek() or discard().
+//
+// The outputs are full 64 bit words, so this is also a good fit for
+// MutableCategoricalArray::sample64().
+#ifndef CPP_PHILOX4X32_H
+#define CPP_PHILOX4X32_H
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+class Philox4x32 {
+public:
+    typedef uint64_t result_type;
+    typedef std::array<uint32_t,4> counter_type;
+    typedef std::array<uint32_t,2> key_type;
+
+    static constexpr int nRounds = 10;
+
+    explicit Philox4x32(uint64_t seed = 0, uint64_t stream = 0) :
+        key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)},
+        streamNumber(stream),
+        nextOutput(0),
+        bufferedBlock(noBlock) { }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() {
+        uint64_t blockIndex = nextOutput >> 1;
+        if(blockIndex != bufferedBlock) {
+            buffer = generate({static_cast<uint32_t>(blockIndex), static_cast<uint32_t>(blockIndex >> 32),
+                               static_cast<uint32_t>(streamNumber), static_cast<uint32_t>(streamNumber >> 32)}, key);
+            bufferedBlock = blockIndex;
+        }
+        int word = (nextOutput & 1) * 2;
+        ++nextOutput;
+        return static_cast<uint64_t>(buffer[word]) | (static_cast<uint64_t>(buffer[word + 1]) << 32);
+    }
+
+    // skips the next n outputs, in O(1) time
+    void discard(unsigned long long n) { nextOutput += n; }
+
+    // moves to the given position in the stream, so the next output is the same as the
+    // (position+1)th output of a newly constructed generator with the same seed and stream
+    void seek(uint64_t position) { nextOutput = position; }
+
+    // the number of outputs taken from the start of the stream
+    uint64_t position() const { return nextOutput; }
+
+    uint64_t stream() const { return streamNumber; }
+
+    // moves to the start of the given stream
+    void setStream(uint64_t stream) {
+        streamNumber = stream;
+        nextOutput = 0;
+        bufferedBlock = noBlock;
+    }
+
+    bool operator ==(const Philox4x32 &other) const {
+        return key == other.key && streamNumber == other.streamNumber && nextOutput == other.nextOutput;
+    }
+
+    bool operator !=(const Philox4x32 &other) const { return !(*this == other); }
+
+    // The Philox4x32-10 bijection, which maps a counter to four random words
+    static counter_type generate(counter_type counter, key_type key) {
+        uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        uint32_t k0 = key[0], k1 = key[1];
+        for(int round = 0; round < nRounds; ++round) {
+            uint64_t product0 = static_cast<uint64_t>(multiplier0) * c0;
+            uint64_t product1 = static_cast<uint64_t>(multiplier1) * c2;
+            c0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+            c1 = static_cast<uint32_t>(product1);
+            c2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+            c3 = static_cast<uint32_t>(product0);
+            k0 += weyl0;
+            k1 += weyl1;
+        }
+        return {c0, c1, c2, c3};
+    }
+
+protected:
+    static constexpr uint32_t multiplier0 = 0xD2511F53;
+    static constexpr uint32_t multiplier1 = 0xCD9E8D57;
+    static constexpr uint32_t weyl0 = 0x9E3779B9;       // golden ratio
+    static constexpr uint32_t weyl1 = 0xBB67AE85;       // sqrt(3) - 1
+    static constexpr uint64_t noBlock = std::numeric_limits<uint64_t>::max();
+
+    key_type        key;
+    uint64_t        streamNumber;
+    uint64_t        nextOutput;     // position in the stream of the next output
+    uint64_t        bufferedBlock;  // the counter of the block in buffer, or noBlock
+    counter_type    buffer;
+};
+
+#endif //CPP_PHILOX4X32_H
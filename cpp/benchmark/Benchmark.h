@@ -0,0 +1,31 @@
+//
+// Simple timing utilities for the benchmarks.
+//
+
+#ifndef CPP_BENCHMARK_H
+#define CPP_BENCHMARK_H
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Prevents the compiler from optimising away a computed value
+template<class T>
+inline void doNotOptimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs operation(nOps) and returns the wall-clock time per operation in nanoseconds.
+template<class OPERATION>
+double nanosPerOp(long nOps, OPERATION &&operation) {
+    auto start = std::chrono::steady_clock::now();
+    operation(nOps);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / nOps;
+}
+
+inline void reportTiming(const std::string &name, long nCategories, double nanosPerOp) {
+    std::cout << name << "\tN=" << nCategories << "\t" << nanosPerOp << " ns/op" << std::endl;
+}
+
+#endif //CPP_BENCHMARK_H
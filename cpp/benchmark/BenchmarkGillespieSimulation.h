@@ -0,0 +1,106 @@
+//
+// Benchmarks for GillespieSimulation
+//
+
+#ifndef CPP_BENCHMARKGILLESPIESIMULATION_H
+#define CPP_BENCHMARKGILLESPIESIMULATION_H
+
+#include <random>
+#include <vector>
+#include "Benchmark.h"
+#include "../GillespieSimulation.h"
+
+class BenchmarkGillespieSimulation {
+public:
+    std::mt19937_64 rng;
+    std::vector<int> sizes = {1000, 100000, 1000000};
+    const long nEvents = 2000000;
+
+    // A reaction-diffusion network on a ring of compartments. In each compartment, A is
+    // created at a constant rate and decays in proportion to its population, and each A hops
+    // to either neighbouring compartment at unit rate. So there are 4 events per compartment,
+    // and each hop changes the rates of 6 events.
+    struct ReactionDiffusionModel {
+        static constexpr int HOPLEFT = 0;
+        static constexpr int HOPRIGHT = 1;
+        static constexpr int CREATE = 2;
+        static constexpr int DECAY = 3;
+        static constexpr double createRate = 10.0;
+        static constexpr double decayRate = 1.0;
+        std::vector<int> population;
+
+        explicit ReactionDiffusionModel(int nCompartments) : population(nCompartments, createRate/decayRate) { }
+
+        int nCompartments() const { return population.size(); }
+
+        int destination(int event) const {
+            int compartment = event/4;
+            return (event % 4 == HOPLEFT) ? (compartment + nCompartments() - 1) % nCompartments() : (compartment + 1) % nCompartments();
+        }
+
+        double rate(int event) const {
+            int n = population[event/4];
+            switch(event % 4) {
+                case CREATE:    return createRate;
+                case DECAY:     return decayRate * n;
+                default:        return n;
+            }
+        }
+
+        void fire(int event) {
+            int compartment = event/4;
+            switch(event % 4) {
+                case CREATE:    ++population[compartment]; break;
+                case DECAY:     if(population[compartment] > 0) --population[compartment]; break;
+                default:        if(population[compartment] > 0) {
+                                    --population[compartment];
+                                    ++population[destination(event)];
+                                }
+            }
+        }
+
+        EventDependencyGraph dependencies() const {
+            EventDependencyGraph graph;
+            for(int event = 0; event < 4 * nCompartments(); ++event) {
+                int compartment = event/4;
+                std::vector<int> dependents {4*compartment + HOPLEFT, 4*compartment + HOPRIGHT, 4*compartment + DECAY};
+                if(event % 4 == HOPLEFT || event % 4 == HOPRIGHT) {
+                    int dest = destination(event);
+                    dependents.insert(dependents.end(), {4*dest + HOPLEFT, 4*dest + HOPRIGHT, 4*dest + DECAY});
+                }
+                graph.addEvent(dependents.begin(), dependents.end());
+            }
+            return graph;
+        }
+    };
+
+    // events per second for exact steps and for tau-leaps firing about 1000 events per leap
+    void doBenchmark() {
+        for(int N : sizes) {
+            ReactionDiffusionModel model(N);
+            GillespieSimulation<ReactionDiffusionModel> simulation(model, model.dependencies());
+            double step = nanosPerOp(nEvents, [&](long n) {
+                for(long s = 0; s < n; ++s) simulation.step(rng);
+                doNotOptimize(simulation.time());
+            });
+            reportEventRate("SSA step", 4*N, step);
+
+            double tau = 1000.0 / simulation.totalRate();
+            long nLeaps = nEvents / 1000;
+            long firedBefore = simulation.nEventsFired();
+            double leap = nanosPerOp(nLeaps, [&](long n) {
+                for(long s = 0; s < n; ++s) simulation.leap(rng, tau);
+                doNotOptimize(simulation.time());
+            });
+            double eventsPerLeap = (simulation.nEventsFired() - firedBefore) / double(nLeaps);
+            reportEventRate("tau-leap", 4*N, leap / eventsPerLeap);
+        }
+    }
+
+    void reportEventRate(const std::string &name, int nEventTypes, double nanosPerEvent) {
+        reportTiming(name, nEventTypes, nanosPerEvent);
+        std::cout << name << "\tN=" << nEventTypes << "\t" << 1e3/nanosPerEvent << " million events/s" << std::endl;
+    }
+};
+
+#endif //CPP_BENCHMARKGILLESPIESIMULATION_H
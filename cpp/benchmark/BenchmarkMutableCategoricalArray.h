@@ -0,0 +1,451 @@
+//
+// Benchmarks for MutableCategoricalArray
+//
+
+#ifndef CPP_BENCHMARKMUTABLECATEGORICALARRAY_H
+#define CPP_BENCHMARKMUTABLECATEGORICALARRAY_H
+
+#include <random>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include "Benchmark.h"
+#include "../MutableCategoricalArray.h"
+#include "../MutableCategoricalKaryArray.h"
+#include "../MutableCategoricalAdaptiveArray.h"
+#include "../MutableCategoricalRejectionArray.h"
+#include "../MutableCategoricalConcurrentArray.h"
+#include "../MutableCategoricalRangeArray.h"
+#include "../MutableCategoricalGroups.h"
+#include "../MutableCategoricalArraySnapshot.h"
+#include "../Philox4x32.h"
+#include <fstream>
+#include <cstdio>
+
+class BenchmarkMutableCategoricalArray {
+public:
+    std::mt19937 rng;
+    std::vector<int> sizes = {1000, 100000, 10000000};
+    const long nSamples = 10000000;
+
+    void doBenchmark() {
+        benchmarkSample();
+        benchmarkSetMany();
+        benchmarkKary<8>();
+        benchmarkKary<16>();
+        benchmarkAdaptive();
+        benchmarkRejection();
+        benchmarkConcurrent();
+        benchmarkParallelBuild();
+        benchmarkSnapshot();
+        benchmarkLeafWeights();
+        benchmarkSample64();
+        benchmarkRangeUpdates();
+        benchmarkGroups();
+    }
+
+    // compares scalar draws using operator() with batched draws using sample()
+    void benchmarkSample() {
+        std::vector<int> samples(nSamples);
+        for(int N : sizes) {
+            std::uniform_real_distribution<double> uniform;
+            MutableCategoricalArray<> dist(N, [&](int i) { return uniform(rng); });
+            double scalar = nanosPerOp(nSamples, [&](long n) {
+                for(long s = 0; s < n; ++s) samples[s] = dist(rng);
+                doNotOptimize(samples.back());
+            });
+            double batch = nanosPerOp(nSamples, [&](long n) {
+                dist.sample(rng, n, samples.begin());
+                doNotOptimize(samples.back());
+            });
+            reportTiming("scalar sample", N, scalar);
+            reportTiming("batch sample", N, batch);
+        }
+    }
+
+    // compares sequential set() calls with a single setMany() over the same updates
+    void benchmarkSetMany() {
+        const int nUpdates = 100000;
+        for(int N : sizes) {
+            std::uniform_real_distribution<double> uniform;
+            std::uniform_int_distribution<int> indexDist(0, N-1);
+            MutableCategoricalArray<> dist(N, [&](int i) { return uniform(rng); });
+            std::vector<int> indices(nUpdates);
+            std::vector<double> weights(nUpdates);
+            for(int j = 0; j < nUpdates; ++j) {
+                indices[j] = indexDist(rng);
+                weights[j] = uniform(rng);
+            }
+            double sequential = nanosPerOp(nUpdates, [&](long n) {
+                for(long j = 0; j < n; ++j) dist.set(indices[j], weights[j]);
+                doNotOptimize(dist.sum());
+            });
+            double bulk = nanosPerOp(nUpdates, [&](long n) {
+                dist.setMany(indices, weights);
+                doNotOptimize(dist.sum());
+            });
+            reportTiming("sequential set", N, sequential);
+            reportTiming("setMany", N, bulk);
+        }
+    }
+
+    // compares sampling and set() on the binary tree and a B-ary tree of the same weights
+    template<int B>
+    void benchmarkKary() {
+        const long nUpdates = 1000000;
+        for(int N : sizes) {
+            std::uniform_real_distribution<double> uniform;
+            std::uniform_int_distribution<int> indexDist(0, N-1);
+            std::vector<double> weights(N);
+            for(double &weight: weights) weight = uniform(rng);
+            MutableCategoricalArray<> binary(N, [&](int i) { return weights[i]; });
+            MutableCategoricalKaryArray<B> kary(N, [&](int i) { return weights[i]; });
+            std::vector<int> indices(nUpdates);
+            std::vector<double> newWeights(nUpdates);
+            for(int j = 0; j < nUpdates; ++j) {
+                indices[j] = indexDist(rng);
+                newWeights[j] = uniform(rng);
+            }
+
+            double binarySample = nanosPerOp(nSamples, [&](long n) {
+                long total = 0;
+                for(long s = 0; s < n; ++s) total += binary(rng);
+                doNotOptimize(total);
+            });
+            double karySample = nanosPerOp(nSamples, [&](long n) {
+                long total = 0;
+                for(long s = 0; s < n; ++s) total += kary(rng);
+                doNotOptimize(total);
+            });
+            double binarySet = nanosPerOp(nUpdates, [&](long n) {
+                for(long j = 0; j < n; ++j) binary.set(indices[j], newWeights[j]);
+                doNotOptimize(binary.sum());
+            });
+            double karySet = nanosPerOp(nUpdates, [&](long n) {
+                for(long j = 0; j < n; ++j) kary.set(indices[j], newWeights[j]);
+                doNotOptimize(kary.sum());
+            });
+            std::string karyName = std::to_string(B) + "-ary";
+            reportTiming("binary sample", N, binarySample);
+            reportTiming(karyName + " sample", N, karySample);
+            reportTiming("binary set", N, binarySet);
+            reportTiming(karyName + " set", N, karySet);
+        }
+    }
+
+    // compares the tree with the adaptive alias table at various ratios of draws to set()s.
+    // Times are per draw, including the set()s.
+    void benchmarkAdaptive() {
+        for(int N : sizes) {
+            std::uniform_real_distribution<double> uniform;
+            std::uniform_int_distribution<int> indexDist(0, N-1);
+            MutableCategoricalArray<> tree(N, [&](int i) { return uniform(rng); });
+            MutableCategoricalAdaptiveArray<> adaptive(N, [&](int i) { return tree[i]; });
+            for(long drawsPerSet : {1L, 100L, 10000L, 1000000L}) {
+                auto drawAndSet = [&](auto &dist, long n) {
+                    long total = 0;
+                    for(long s = 0; s < n; ++s) {
+                        total += dist(rng);
+                        if(s % drawsPerSet == drawsPerSet - 1) dist.set(indexDist(rng), uniform(rng));
+                    }
+                    doNotOptimize(total);
+                };
+                double treeTime = nanosPerOp(nSamples, [&](long n) { drawAndSet(tree, n); });
+                double adaptiveTime = nanosPerOp(nSamples, [&](long n) { drawAndSet(adaptive, n); });
+                std::string ratio = std::to_string(drawsPerSet) + ":1";
+                reportTiming("tree draw:set " + ratio, N, treeTime);
+                reportTiming("adaptive draw:set " + ratio, N, adaptiveTime);
+            }
+        }
+    }
+
+    // compares sampling and set() on the binary tree and the grouped rejection sampler
+    // up to N=10^8. Only one distribution is held in memory at a time.
+    void benchmarkRejection() {
+        const long nOps = 1000000;
+        for(int N : {1000, 100000, 10000000, 100000000}) {
+            benchmarkSampleAndSet<MutableCategoricalArray<>>("binary", N, nOps);
+            benchmarkSampleAndSet<MutableCategoricalRejectionArray>("rejection", N, nOps);
+        }
+    }
+
+    // compares get(), set() and sampling with and without leaf weights, along with the memory used
+    void benchmarkLeafWeights() {
+        const long nOps = 1000000;
+        for(int N : sizes) {
+            benchmarkGet<MutableCategoricalArray<>>("binary", N, nOps);
+            benchmarkSampleAndSet<MutableCategoricalArray<>>("binary", N, nOps);
+            benchmarkGet<MutableCategoricalArrayWithLeafWeights<>>("leaf weights", N, nOps);
+            benchmarkSampleAndSet<MutableCategoricalArrayWithLeafWeights<>>("leaf weights", N, nOps);
+        }
+    }
+
+    // compares MutableCategoricalGroups with a separate MutableCategoricalArray per group, an
+    // outer array of group sums maintained by hand and a table of the (group, position) of
+    // each item, for N items in sqrt(N) groups
+    void benchmarkGroups() {
+        const long nOps = 1000000;
+        for(int N : sizes) {
+            int nGroups = std::sqrt(N);
+            std::uniform_real_distribution<double> uniform;
+            MutableCategoricalGroups<> groups(nGroups);
+            std::vector<MutableCategoricalArray<>> separate(nGroups);
+            MutableCategoricalArray<> outer(nGroups);
+            std::vector<std::pair<int,int>> location(N);
+            for(int i = 0; i < N; ++i) {
+                double weight = uniform(rng);
+                groups.add(i % nGroups, weight);
+                location[i] = {i % nGroups, separate[i % nGroups].size()};
+                separate[i % nGroups].push_back(weight);
+            }
+            for(int g = 0; g < nGroups; ++g) outer.set(g, separate[g].sum());
+            std::uniform_int_distribution<int> itemDist(0, N - 1);
+            std::vector<int> items(nOps);
+            for(int &item: items) item = itemDist(rng);
+            double separateSet = nanosPerOp(nOps, [&](long n) {
+                for(long j = 0; j < n; ++j) {
+                    int g = location[items[j]].first;
+                    separate[g].set(location[items[j]].second, 0.5);
+                    outer.set(g, separate[g].sum());
+                }
+                doNotOptimize(outer.sum());
+            });
+            double groupsSet = nanosPerOp(nOps, [&](long n) {
+                for(long j = 0; j < n; ++j) groups.set(items[j], 0.5);
+                doNotOptimize(groups.sum());
+            });
+            reportTiming("separate arrays set", N, separateSet);
+            reportTiming("groups set", N, groupsSet);
+            benchmarkDraws("separate arrays sample", N, [&]() {
+                int g = outer(rng);
+                return separate[g](rng) * nGroups + g;
+            });
+            benchmarkDraws("groups sample", N, [&]() { return groups(rng); });
+        }
+    }
+
+    // compares adding to a block of k weights by k calls to set() on MutableCategoricalArray
+    // with one addRange() on MutableCategoricalRangeArray, along with the cost of draws
+    void benchmarkRangeUpdates() {
+        const long nOps = 100000;
+        for(int N : sizes) {
+            std::uniform_real_distribution<double> uniform;
+            MutableCategoricalArray<> array(N, [&](int i) { return uniform(rng); });
+            MutableCategoricalRangeArray rangeArray(N, [&](int i) { return array[i]; });
+            for(int k : {10, 1000}) {
+                std::uniform_int_distribution<int> beginDist(0, N - k);
+                std::vector<int> begins(nOps);
+                for(int &begin: begins) begin = beginDist(rng);
+                double set = nanosPerOp(nOps, [&](long n) {
+                    for(long j = 0; j < n; ++j) {
+                        for(int i = begins[j]; i < begins[j] + k; ++i) array.set(i, array.get(i) + 1e-3);
+                    }
+                    doNotOptimize(array.sum());
+                });
+                double addRange = nanosPerOp(nOps, [&](long n) {
+                    for(long j = 0; j < n; ++j) rangeArray.addRange(begins[j], begins[j] + k, 1e-3);
+                    doNotOptimize(rangeArray.sum());
+                });
+                reportTiming("k=" + std::to_string(k) + " set() loop", N, set);
+                reportTiming("k=" + std::to_string(k) + " addRange", N, addRange);
+            }
+            benchmarkDraws("binary sample", N, [&]() { return array(rng); });
+            benchmarkDraws("range array sample", N, [&]() { return rangeArray(rng); });
+        }
+    }
+
+    // compares operator() with mt19937, as used above, against sample64() with mt19937_64 and
+    // Philox4x32, for floating point and integer weights, along with the cost of the generators alone
+    void benchmarkSample64() {
+        std::mt19937_64 mersenne64;
+        Philox4x32 philox(1);
+        reportTiming("mt19937 alone", 0, nanosPerOp(nSamples, [&](long n) {
+            uint32_t total = 0;
+            for(long s = 0; s < n; ++s) total += rng();
+            doNotOptimize(total);
+        }));
+        reportTiming("mt19937_64 alone", 0, nanosPerOp(nSamples, [&](long n) {
+            uint64_t total = 0;
+            for(long s = 0; s < n; ++s) total += mersenne64();
+            doNotOptimize(total);
+        }));
+        reportTiming("Philox4x32 alone", 0, nanosPerOp(nSamples, [&](long n) {
+            uint64_t total = 0;
+            for(long s = 0; s < n; ++s) total += philox();
+            doNotOptimize(total);
+        }));
+        for(int N : sizes) {
+            std::uniform_real_distribution<double> uniform;
+            MutableCategoricalArray<> dist(N, [&](int i) { return uniform(rng); });
+            MutableCategoricalArray<uint64_t> integerDist(N, [&](int i) { return rng() % 1000; });
+            benchmarkDraws("double operator() mt19937", N, [&]() { return dist(rng); });
+            benchmarkDraws("double sample64 mt19937_64", N, [&]() { return dist.sample64(mersenne64); });
+            benchmarkDraws("double sample64 Philox4x32", N, [&]() { return dist.sample64(philox); });
+            benchmarkDraws("uint64 operator() mt19937", N, [&]() { return integerDist(rng); });
+            benchmarkDraws("uint64 sample64 mt19937_64", N, [&]() { return integerDist.sample64(mersenne64); });
+            benchmarkDraws("uint64 sample64 Philox4x32", N, [&]() { return integerDist.sample64(philox); });
+        }
+    }
+
+    template<class DRAW>
+    void benchmarkDraws(const std::string &name, int N, DRAW draw) {
+        double nanos = nanosPerOp(nSamples, [&](long n) {
+            long total = 0;
+            for(long s = 0; s < n; ++s) total += draw();
+            doNotOptimize(total);
+        });
+        reportTiming(name, N, nanos);
+        std::cout << name << "\tN=" << N << "\t" << 1e3/nanos << " million draws/s" << std::endl;
+    }
+
+    template<class ARRAY>
+    void benchmarkGet(const std::string &name, int N, long nOps) {
+        std::uniform_real_distribution<double> uniform;
+        std::uniform_int_distribution<int> indexDist(0, N-1);
+        ARRAY dist(N, [&](int i) { return uniform(rng); });
+        std::vector<int> indices(nOps);
+        for(int j = 0; j < nOps; ++j) indices[j] = indexDist(rng);
+        double get = nanosPerOp(nOps, [&](long n) {
+            double total = 0.0;
+            for(long j = 0; j < n; ++j) total += dist.get(indices[j]);
+            doNotOptimize(total);
+        });
+        reportTiming(name + " get", N, get);
+        std::cout << name << "\tN=" << N << "\t" << dist.stats().memoryBytes / double(N) << " bytes/category" << std::endl;
+    }
+
+    template<class ARRAY>
+    void benchmarkSampleAndSet(const std::string &name, int N, long nOps) {
+        std::uniform_real_distribution<double> uniform;
+        std::uniform_int_distribution<int> indexDist(0, N-1);
+        ARRAY dist(N, [&](int i) { return uniform(rng); });
+        std::vector<int> indices(nOps);
+        std::vector<double> newWeights(nOps);
+        for(int j = 0; j < nOps; ++j) {
+            indices[j] = indexDist(rng);
+            newWeights[j] = uniform(rng);
+        }
+        double sample = nanosPerOp(nOps, [&](long n) {
+            long total = 0;
+            for(long s = 0; s < n; ++s) total += dist(rng);
+            doNotOptimize(total);
+        });
+        double set = nanosPerOp(nOps, [&](long n) {
+            for(long j = 0; j < n; ++j) dist.set(indices[j], newWeights[j]);
+            doNotOptimize(dist.sum());
+        });
+        reportTiming(name + " sample", N, sample);
+        reportTiming(name + " set", N, set);
+    }
+
+    // Multi-threaded throughput: nReaders threads draw while one thread repeatedly sets
+    // random weights. Compares the lock-free MutableCategoricalConcurrentArray with a
+    // MutableCategoricalArray guarded by a reader-writer lock. Times are wall-clock time
+    // per draw summed over all readers (i.e. the inverse of the total draw throughput) and
+    // wall-clock time per set() in the writer, so a writer starved by the lock shows up
+    // as a long time per set.
+    void benchmarkConcurrent() {
+        const int N = 1000000;
+        unsigned int maxReaders = std::max(2u, std::thread::hardware_concurrency());
+        std::uniform_real_distribution<double> uniform;
+        std::vector<double> weights(N);
+        for(double &weight: weights) weight = uniform(rng);
+        MutableCategoricalConcurrentArray<> concurrent(weights.begin(), weights.end());
+        MutableCategoricalArray<> locked(weights.begin(), weights.end());
+        std::shared_mutex lock;
+        for(unsigned int nReaders = 1; nReaders <= maxReaders; nReaders *= 2) {
+            std::string threads = std::to_string(nReaders) + " readers + 1 writer";
+            benchmarkConcurrentAccess("lock-free " + threads, nReaders, N,
+                    [&](std::mt19937 &gen) { return concurrent(gen); },
+                    [&](int i, double w) { concurrent.set(i, w); });
+            benchmarkConcurrentAccess("shared_mutex " + threads, nReaders, N,
+                    [&](std::mt19937 &gen) { std::shared_lock<std::shared_mutex> guard(lock); return locked(gen); },
+                    [&](int i, double w) { std::unique_lock<std::shared_mutex> guard(lock); locked.set(i, w); });
+        }
+    }
+
+    template<class DRAW, class SET>
+    void benchmarkConcurrentAccess(const std::string &name, int nReaders, int N, DRAW draw, SET set) {
+        const long drawsPerReader = 1000000;
+        std::atomic<bool> finishedReading(false);
+        long nSets = 0;
+        std::thread writer([&]() {
+            std::mt19937 writerRng(0);
+            std::uniform_real_distribution<double> uniform;
+            std::uniform_int_distribution<int> indexDist(0, N-1);
+            while(!finishedReading) {
+                set(indexDist(writerRng), uniform(writerRng));
+                ++nSets;
+            }
+        });
+        double nanosPerDraw = nanosPerOp(nReaders * drawsPerReader, [&](long) {
+            std::vector<std::thread> readers;
+            for(int reader = 0; reader < nReaders; ++reader) {
+                readers.emplace_back([&, reader]() {
+                    std::mt19937 readerRng(reader + 1);
+                    long total = 0;
+                    for(long s = 0; s < drawsPerReader; ++s) total += draw(readerRng);
+                    doNotOptimize(total);
+                });
+            }
+            for(std::thread &reader: readers) reader.join();
+            finishedReading = true;
+        });
+        writer.join();
+        double nanosPerSet = nanosPerDraw * nReaders * drawsPerReader / std::max(nSets, 1L);
+        reportTiming(name + " draw", N, nanosPerDraw);
+        reportTiming(name + " set", N, nanosPerSet);
+    }
+
+    // time to build the tree from N weights on different numbers of threads
+    void benchmarkParallelBuild() {
+        const int N = 100000000;
+        std::uniform_real_distribution<double> uniform;
+        std::vector<double> weights(N);
+        for(double &weight: weights) weight = uniform(rng);
+        unsigned int maxThreads = std::max(4u, std::thread::hardware_concurrency());
+        for(unsigned int nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+            double nanos = nanosPerOp(N, [&](long n) {
+                MutableCategoricalArray<> dist(N, [&weights](int i) { return weights[i]; }, nThreads);
+                doNotOptimize(dist.sum());
+            });
+            reportTiming("build on " + std::to_string(nThreads) + " threads", N, nanos);
+        }
+    }
+
+    // time to get a usable array by building from weights, reading a snapshot, or mapping
+    // a snapshot and taking a draw. Times are per category.
+    void benchmarkSnapshot() {
+        const int N = 10000000;
+        const std::string path = "benchmarkSnapshot.bin";
+        std::uniform_real_distribution<double> uniform;
+        std::vector<double> weights(N);
+        for(double &weight: weights) weight = uniform(rng);
+        {
+            std::ofstream out(path, std::ios::binary);
+            MutableCategoricalArraySnapshot<>::Writer writer(out);
+            for(double weight: weights) writer.push_back(weight);
+        }
+        double build = nanosPerOp(N, [&](long n) {
+            MutableCategoricalArray<> dist(weights.begin(), weights.end());
+            doNotOptimize(dist(rng));
+        });
+        double read = nanosPerOp(N, [&](long n) {
+            std::ifstream in(path, std::ios::binary);
+            MutableCategoricalArray<> dist = MutableCategoricalArraySnapshot<>::read(in);
+            doNotOptimize(dist(rng));
+        });
+        double map = nanosPerOp(N, [&](long n) {
+            auto dist = MutableCategoricalArraySnapshot<>::map(path);
+            doNotOptimize(dist(rng));
+        });
+        std::remove(path.c_str());
+        reportTiming("build from weights", N, build);
+        reportTiming("read snapshot", N, read);
+        reportTiming("map snapshot", N, map);
+    }
+};
+
+#endif //CPP_BENCHMARKMUTABLECATEGORICALARRAY_H
@@ -0,0 +1,115 @@
+//
+// Benchmarks for MutableCategoricalMap
+//
+
+#ifndef CPP_BENCHMARKMUTABLECATEGORICALMAP_H
+#define CPP_BENCHMARKMUTABLECATEGORICALMAP_H
+
+#include <random>
+#include <string>
+#include <vector>
+#include "Benchmark.h"
+#include "../MutableCategoricalMap.h"
+#include "../MutableCategoricalCompactMap.h"
+
+class BenchmarkMutableCategoricalMap {
+public:
+    std::mt19937 rng;
+    std::vector<int> sizes = {1000, 100000, 1000000};
+
+    void doBenchmark() {
+        benchmarkChurn();
+        benchmarkConstruction();
+        benchmarkLayout<MutableCategoricalMap<int>>("map");
+        benchmarkLayout<MutableCategoricalCompactMap<int>>("compact map");
+    }
+
+    // erases a randomly chosen category and adds a new one, keeping the size constant
+    void benchmarkChurn() {
+        const long nOps = 1000000;
+        for(int N : sizes) {
+            std::uniform_real_distribution<double> uniform;
+            std::uniform_int_distribution<int> indexDist(0, N-1);
+            MutableCategoricalMap<int> dist;
+            std::vector<MutableCategoricalMap<int>::iterator> categories;
+            for(int i = 0; i < N; ++i) categories.push_back(dist.add(i, uniform(rng)));
+            double churn = nanosPerOp(nOps, [&](long n) {
+                for(long j = 0; j < n; ++j) {
+                    int index = indexDist(rng);
+                    dist.erase(categories[index]);
+                    categories[index] = dist.add(index, uniform(rng));
+                }
+                doNotOptimize(dist.sum());
+            });
+            reportTiming("map erase+add", N, churn);
+        }
+    }
+
+    // compares building by repeated add() with bulk construction, and the resulting sample times
+    void benchmarkConstruction() {
+        const long nSamples = 1000000;
+        for(int N : sizes) {
+            std::exponential_distribution<double> exponential;
+            std::vector<std::pair<int,double>> entries;
+            for(int i = 0; i < N; ++i) entries.emplace_back(i, exponential(rng));
+            MutableCategoricalMap<int> added, binary, huffman;
+            double addTime = nanosPerOp(N, [&](long n) {
+                for(const std::pair<int,double> &entry: entries) added.add(entry.first, entry.second);
+            });
+            double binaryTime = nanosPerOp(N, [&](long n) { binary.createBinaryTree(entries.begin(), entries.end()); });
+            double huffmanTime = nanosPerOp(N, [&](long n) { huffman.createHuffmanTree(entries.begin(), entries.end()); });
+            reportTiming("map add() construction", N, addTime);
+            reportTiming("map binary construction", N, binaryTime);
+            reportTiming("map Huffman construction", N, huffmanTime);
+            for(auto *dist : {&added, &binary, &huffman}) {
+                double sampleTime = nanosPerOp(nSamples, [&](long n) {
+                    long total = 0;
+                    for(long s = 0; s < n; ++s) total += (*dist)(rng)->value;
+                    doNotOptimize(total);
+                });
+                reportTiming(dist == &added ? "map sample (add)" : dist == &binary ? "map sample (binary)" : "map sample (Huffman)", N, sampleTime);
+            }
+        }
+    }
+
+    // compares the pointer-based and index-based node layouts: memory per category and the
+    // times to add, sample, set and erase+add
+    template<class MAP>
+    void benchmarkLayout(const std::string &name) {
+        const long nOps = 1000000;
+        for(int N : sizes) {
+            std::uniform_real_distribution<double> uniform;
+            std::uniform_int_distribution<int> indexDist(0, N-1);
+            MAP dist;
+            std::vector<typename MAP::iterator> categories;
+            categories.reserve(N);
+            double addTime = nanosPerOp(N, [&](long n) {
+                for(int i = 0; i < n; ++i) categories.push_back(dist.add(i, uniform(rng)));
+            });
+            double sampleTime = nanosPerOp(nOps, [&](long n) {
+                long total = 0;
+                for(long s = 0; s < n; ++s) total += static_cast<int>(*dist(rng));
+                doNotOptimize(total);
+            });
+            double setTime = nanosPerOp(nOps, [&](long n) {
+                for(long j = 0; j < n; ++j) dist.set(categories[indexDist(rng)], uniform(rng));
+                doNotOptimize(dist.sum());
+            });
+            double churnTime = nanosPerOp(nOps, [&](long n) {
+                for(long j = 0; j < n; ++j) {
+                    int index = indexDist(rng);
+                    dist.erase(categories[index]);
+                    categories[index] = dist.add(index, uniform(rng));
+                }
+                doNotOptimize(dist.sum());
+            });
+            reportTiming(name + " add", N, addTime);
+            reportTiming(name + " sample", N, sampleTime);
+            reportTiming(name + " set", N, setTime);
+            reportTiming(name + " erase+add", N, churnTime);
+            std::cout << name << "\tN=" << N << "\t" << dist.stats().memoryBytes / double(N) << " bytes/category" << std::endl;
+        }
+    }
+};
+
+#endif //CPP_BENCHMARKMUTABLECATEGORICALMAP_H
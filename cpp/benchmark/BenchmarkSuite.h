@@ -0,0 +1,313 @@
+//
+// A benchmark suite that times the basic operations of MutableCategoricalArray,
+// MutableCategorical and MutableCategoricalMap over a range of sizes and weight distributions,
+// and writes the results as CSV or JSON so they can be compared between releases.
+//
+// The weight distributions are those of the Kotlin meanPerformance experiment:
+// Uniform on [0,1), Exponential with mean 1 and Resonance, which is 1.0 with probability 0.99
+// and 1000.0 otherwise.
+//
+// Each case (class, weight distribution, N) runs in a child process, so the peak resident set
+// size reported is that of the case alone, and a case that runs out of memory is reported
+// on stderr and skipped rather than stopping the suite. POSIX only.
+//
+
+#ifndef CPP_BENCHMARKSUITE_H
+#define CPP_BENCHMARKSUITE_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "Benchmark.h"
+#include "../MutableCategoricalArray.h"
+#include "../MutableCategorical.h"
+#include "../MutableCategoricalMap.h"
+
+class BenchmarkSuite {
+public:
+    enum Format { CSV, JSON };
+
+    struct Result {
+        std::string distribution;
+        std::string operation;
+        std::string weights;
+        long        nCategories;
+        long        nOps;
+        double      nanosPerOp;
+        long        peakRssBytes;
+
+        double opsPerSecond() const { return 1.0e9 / nanosPerOp; }
+    };
+
+    struct WeightMix {
+        std::string                                     name;
+        std::function<double(std::mt19937 &)>          generate;
+    };
+
+    long    minCategories = 100;
+    long    maxCategories = 100000000;
+    long    opsPerMeasurement = 1000000;    // operations timed per measurement
+    int     nRepeats = 3;                   // the median of this many measurements is reported
+    Format  format = CSV;
+
+    std::vector<WeightMix> weightMixes = {
+            {"Uniform",     [](std::mt19937 &rng) { return std::uniform_real_distribution<double>()(rng); }},
+            {"Exponential", [](std::mt19937 &rng) { return std::exponential_distribution<double>()(rng); }},
+            {"Resonance",   [](std::mt19937 &rng) { return std::uniform_real_distribution<double>()(rng) < 0.99 ? 1.0 : 1000.0; }}
+    };
+
+    void run(std::ostream &out) {
+        std::vector<Result> results;
+        for(const std::string &distribution: {"MutableCategoricalArray", "MutableCategorical", "MutableCategoricalMap"}) {
+            for(const WeightMix &mix: weightMixes) {
+                for(long N = minCategories; N <= maxCategories; N *= 10) {
+                    std::cerr << distribution << " " << mix.name << " N=" << N << std::endl;
+                    runInChildProcess(distribution, mix, N, results);
+                }
+            }
+        }
+        if(format == CSV) writeCSV(results, out); else writeJSON(results, out);
+    }
+
+    static void writeCSV(const std::vector<Result> &results, std::ostream &out) {
+        out << "distribution,operation,weights,N,ops,ns_per_op,ops_per_second,peak_rss_bytes\n";
+        for(const Result &result: results) {
+            out << result.distribution << "," << result.operation << "," << result.weights << ","
+                << result.nCategories << "," << result.nOps << "," << result.nanosPerOp << ","
+                << result.opsPerSecond() << "," << result.peakRssBytes << "\n";
+        }
+    }
+
+    static void writeJSON(const std::vector<Result> &results, std::ostream &out) {
+        out << "[\n";
+        for(size_t r = 0; r < results.size(); ++r) {
+            const Result &result = results[r];
+            out << "  {\"distribution\": \"" << result.distribution
+                << "\", \"operation\": \"" << result.operation
+                << "\", \"weights\": \"" << result.weights
+                << "\", \"N\": " << result.nCategories
+                << ", \"ops\": " << result.nOps
+                << ", \"ns_per_op\": " << result.nanosPerOp
+                << ", \"ops_per_second\": " << result.opsPerSecond()
+                << ", \"peak_rss_bytes\": " << result.peakRssBytes
+                << (r + 1 < results.size() ? "},\n" : "}\n");
+        }
+        out << "]\n";
+    }
+
+protected:
+
+    // Random inputs are drawn in advance and cycled through, so the timings don't include
+    // the random number generation for the inputs.
+    static constexpr int nInputs = 1 << 16;
+
+    struct Case {
+        std::string             distribution;
+        std::string             weights;
+        long                    nCategories;
+        std::vector<double>     initialWeights;
+        std::vector<int>        indices;        // random indices in [0, nCategories)
+        std::vector<double>     newWeights;     // random weights from the mix
+        std::vector<Result>     results;
+    };
+
+    void runInChildProcess(const std::string &distribution, const WeightMix &mix, long N, std::vector<Result> &results) {
+        int fd[2];
+        if(pipe(fd) != 0) {
+            std::cerr << "Couldn't create pipe for benchmark case" << std::endl;
+            return;
+        }
+        std::cout.flush();
+        pid_t pid = fork();
+        if(pid == 0) {
+            close(fd[0]);
+            Case benchmarkCase = createCase(distribution, mix, N);
+            if(distribution == "MutableCategoricalArray") benchmarkArray(benchmarkCase);
+            else if(distribution == "MutableCategorical") benchmarkCategorical(benchmarkCase);
+            else benchmarkMap(benchmarkCase);
+            long peakRss = peakRssBytes();
+            std::ostringstream message;
+            message << std::setprecision(10);
+            for(const Result &result: benchmarkCase.results) {
+                message << result.operation << '\t' << result.nOps << '\t' << result.nanosPerOp << '\t' << peakRss << '\n';
+            }
+            std::string text = message.str();
+            for(size_t written = 0; written < text.size(); ) {
+                ssize_t n = write(fd[1], text.data() + written, text.size() - written);
+                if(n <= 0) break;
+                written += n;
+            }
+            close(fd[1]);
+            _exit(0);
+        }
+        close(fd[1]);
+        std::string text;
+        char buffer[4096];
+        ssize_t n;
+        while((n = read(fd[0], buffer, sizeof(buffer))) > 0) text.append(buffer, n);
+        close(fd[0]);
+        int status = 0;
+        if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "Benchmark case " << distribution << " " << mix.name << " N=" << N << " failed" << std::endl;
+            return;
+        }
+        std::istringstream lines(text);
+        Result result{distribution, "", mix.name, N};
+        while(std::getline(lines, result.operation, '\t') && lines >> result.nOps >> result.nanosPerOp >> result.peakRssBytes) {
+            lines.ignore(1);
+            results.push_back(result);
+        }
+    }
+
+    Case createCase(const std::string &distribution, const WeightMix &mix, long N) {
+        std::mt19937 rng(N);
+        Case benchmarkCase{distribution, mix.name, N};
+        benchmarkCase.initialWeights.resize(N);
+        for(double &weight: benchmarkCase.initialWeights) weight = mix.generate(rng);
+        std::uniform_int_distribution<int> indexDist(0, N - 1);
+        for(int i = 0; i < nInputs; ++i) {
+            benchmarkCase.indices.push_back(indexDist(rng));
+            benchmarkCase.newWeights.push_back(mix.generate(rng));
+        }
+        return benchmarkCase;
+    }
+
+    // times nOps calls of operation(j) and adds the median time per operation to the results
+    template<class OPERATION>
+    void measure(Case &benchmarkCase, const std::string &operation, long nOps, OPERATION &&op) {
+        std::vector<double> timings;
+        for(int repeat = 0; repeat < nRepeats; ++repeat) {
+            timings.push_back(nanosPerOp(nOps, [&op](long n) {
+                for(long j = 0; j < n; ++j) op(j);
+            }));
+        }
+        std::nth_element(timings.begin(), timings.begin() + nRepeats/2, timings.end());
+        benchmarkCase.results.push_back(Result{benchmarkCase.distribution, operation, benchmarkCase.weights,
+                                               benchmarkCase.nCategories, nOps, timings[nRepeats/2]});
+    }
+
+    // construction is timed per category, building enough times to make at least
+    // opsPerMeasurement categories in total
+    template<class BUILD>
+    void measureConstruction(Case &benchmarkCase, BUILD &&build) {
+        long N = benchmarkCase.nCategories;
+        long nBuilds = std::max(1L, opsPerMeasurement / N);
+        std::vector<double> timings;
+        for(int repeat = 0; repeat < nRepeats; ++repeat) {
+            timings.push_back(nanosPerOp(nBuilds * N, [&build, nBuilds](long n) {
+                for(long b = 0; b < nBuilds; ++b) build();
+            }));
+        }
+        std::nth_element(timings.begin(), timings.begin() + nRepeats/2, timings.end());
+        benchmarkCase.results.push_back(Result{benchmarkCase.distribution, "construction", benchmarkCase.weights,
+                                               N, nBuilds * N, timings[nRepeats/2]});
+    }
+
+    void benchmarkArray(Case &c) {
+        std::mt19937 rng;
+        const std::vector<double> &w = c.initialWeights;
+        measureConstruction(c, [&w]() {
+            MutableCategoricalArray<> dist(w.begin(), w.end());
+            doNotOptimize(dist.sum());
+        });
+        MutableCategoricalArray<> dist(w.begin(), w.end());
+        long total = 0;
+        measure(c, "sample", opsPerMeasurement, [&](long j) { total += dist(rng); });
+        measure(c, "set", opsPerMeasurement, [&](long j) {
+            dist.set(c.indices[j % nInputs], c.newWeights[j % nInputs]);
+        });
+        measure(c, "push_back+pop_back", opsPerMeasurement, [&](long j) {
+            dist.push_back(c.newWeights[j % nInputs]);
+            dist.pop_back();
+        });
+        doNotOptimize(total);
+        doNotOptimize(dist.sum());
+    }
+
+    void benchmarkCategorical(Case &c) {
+        std::mt19937 rng;
+        const std::vector<double> &w = c.initialWeights;
+        auto init = [&w](int i) { return std::pair<int,double>(i, w[i]); };
+        measureConstruction(c, [&]() {
+            MutableCategorical<int> dist(c.nCategories, init);
+            doNotOptimize(dist.sum());
+        });
+        MutableCategorical<int> dist(c.nCategories, init);
+        std::vector<MutableCategorical<int>::iterator> handles = sampleOfHandles(dist);
+        long total = 0;
+        measure(c, "sample", opsPerMeasurement, [&](long j) { total += *dist(rng); });
+        measure(c, "set", opsPerMeasurement, [&](long j) {
+            dist.set(handles[c.indices[j % nInputs] % handles.size()], c.newWeights[j % nInputs]);
+        });
+        measure(c, "add+erase", opsPerMeasurement, [&](long j) {
+            auto &handle = handles[c.indices[j % nInputs] % handles.size()];
+            int label = *handle;
+            dist.erase(handle);
+            handle = dist.add(label, c.newWeights[j % nInputs]);
+        });
+        doNotOptimize(total);
+        doNotOptimize(dist.sum());
+    }
+
+    void benchmarkMap(Case &c) {
+        std::mt19937 rng;
+        std::vector<std::pair<int,double>> entries;
+        entries.reserve(c.nCategories);
+        for(int i = 0; i < c.nCategories; ++i) entries.emplace_back(i, c.initialWeights[i]);
+        measureConstruction(c, [&entries]() {
+            MutableCategoricalMap<int> dist;
+            dist.createBinaryTree(entries.begin(), entries.end());
+            doNotOptimize(dist.sum());
+        });
+        MutableCategoricalMap<int> dist;
+        dist.createBinaryTree(entries.begin(), entries.end());
+        std::vector<MutableCategoricalMap<int>::iterator> handles = sampleOfHandles(dist);
+        long total = 0;
+        measure(c, "sample", opsPerMeasurement, [&](long j) { total += dist(rng)->value; });
+        measure(c, "set", opsPerMeasurement, [&](long j) {
+            dist.set(handles[c.indices[j % nInputs] % handles.size()], c.newWeights[j % nInputs]);
+        });
+        measure(c, "add+erase", opsPerMeasurement, [&](long j) {
+            auto &handle = handles[c.indices[j % nInputs] % handles.size()];
+            int label = handle->value;
+            dist.erase(handle);
+            handle = dist.add(label, c.newWeights[j % nInputs]);
+        });
+        doNotOptimize(total);
+        doNotOptimize(dist.sum());
+    }
+
+    // iterators to up to nInputs categories spread evenly through the distribution
+    template<class DIST>
+    static std::vector<typename DIST::iterator> sampleOfHandles(DIST &dist) {
+        std::vector<typename DIST::iterator> handles;
+        long stride = std::max(1L, static_cast<long>(dist.size()) / nInputs);
+        long i = 0;
+        for(auto it = dist.begin(); it != dist.end(); ++it, ++i) {
+            if(i % stride == 0) handles.push_back(it);
+        }
+        return handles;
+    }
+
+    static long peakRssBytes() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return usage.ru_maxrss * 1024L;
+#endif
+    }
+};
+
+#endif //CPP_BENCHMARKSUITE_H
@@ -0,0 +1,63 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "BenchmarkMutableCategoricalArray.h"
+#include "BenchmarkMutableCategoricalMap.h"
+#include "BenchmarkSuite.h"
+#include "BenchmarkGillespieSimulation.h"
+
+// With no arguments, runs the benchmarks of the individual features. With "suite" as the
+// first argument, runs the suite in BenchmarkSuite.h, taking the options
+//   --format csv|json    output format (default csv)
+//   --output FILE        write the results to FILE rather than stdout
+//   --min-n N            smallest number of categories (default 100)
+//   --max-n N            largest number of categories (default 1e8)
+//   --ops N              operations per measurement (default 1e6)
+int runSuite(int argc, char *argv[]) {
+    BenchmarkSuite suite;
+    std::string outputPath;
+    for(int arg = 2; arg + 1 < argc; arg += 2) {
+        std::string option = argv[arg];
+        std::string value = argv[arg + 1];
+        if(option == "--format" && (value == "csv" || value == "json")) {
+            suite.format = (value == "csv") ? BenchmarkSuite::CSV : BenchmarkSuite::JSON;
+        } else if(option == "--output") {
+            outputPath = value;
+        } else if(option == "--min-n") {
+            suite.minCategories = std::stod(value);
+        } else if(option == "--max-n") {
+            suite.maxCategories = std::stod(value);
+        } else if(option == "--ops") {
+            suite.opsPerMeasurement = std::stod(value);
+        } else {
+            std::cerr << "Unrecognised option " << option << " " << value << std::endl;
+            return 1;
+        }
+    }
+    if(outputPath.empty()) {
+        suite.run(std::cout);
+    } else {
+        std::ofstream out(outputPath);
+        suite.run(out);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if(argc > 1 && std::string(argv[1]) == "suite") return runSuite(argc, argv);
+
+    std::cout << "Starting MutableCategoricalArray benchmark" << std::endl;
+    BenchmarkMutableCategoricalArray arrayBenchmark;
+    arrayBenchmark.doBenchmark();
+
+    std::cout << std::endl << "Starting MutableCategoricalMap benchmark" << std::endl;
+    BenchmarkMutableCategoricalMap mapBenchmark;
+    mapBenchmark.doBenchmark();
+
+    std::cout << std::endl << "Starting GillespieSimulation benchmark" << std::endl;
+    BenchmarkGillespieSimulation gillespieBenchmark;
+    gillespieBenchmark.doBenchmark();
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+//
+// Compares the expected depth of a sample from a MutableCategoricalMap, with and without
+// rotation, to that of the optimal Huffman tree, after a long run of random modifications
+// and deletions.
+//
+
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "../MutableCategoricalMap.h"
+#include "../HuffmanLength.h"
+
+std::mt19937 rng;
+
+template<class MAP>
+class ModifiableMap {
+public:
+    MAP map;
+    std::vector<typename MAP::iterator> categories; // end() if not present
+
+    ModifiableMap(const std::vector<std::pair<int,double>> &entries, int maxKey): categories(maxKey + 1, map.end()) {
+        map.createHuffmanTree(entries.begin(), entries.end());
+        for(auto it = map.begin(); it != map.end(); ++it) categories[it->value] = it;
+    }
+
+    bool contains(int key) { return categories[key] != map.end(); }
+
+    void set(int key, double weight) {
+        if(contains(key)) map.set(categories[key], weight); else categories[key] = map.add(key, weight);
+    }
+
+    void remove(int key) {
+        map.erase(categories[key]);
+        categories[key] = map.end();
+    }
+};
+
+
+void calculatePerformance(const std::function<double()> &probGenerator) {
+    const int nItems = 100000;
+    std::vector<std::pair<int,double>> entries;
+    for(int i = 0; i < nItems; ++i) entries.emplace_back(2*i, probGenerator());
+    ModifiableMap<MutableCategoricalMap<int>> categorical(entries, 2*nItems);
+    ModifiableMap<MutableCategoricalMapWithRotation<int>> categoricalRotate(entries, 2*nItems);
+
+    const int nMods = 1000;
+    const int burnIn = 500;
+    double huffmanTotal = 0.0;
+    double catTotal = 0.0;
+    double rotateTotal = 0.0;
+    int count = 0;
+    std::uniform_int_distribution<int> itemDist(0, nItems - 1);
+    std::uniform_int_distribution<int> actionDist(0, 2);
+    for(int m = 1; m <= nMods; ++m) {
+        for(int q = 1; q <= 500; ++q) {
+            int toModify = itemDist(rng);
+            if(actionDist(rng) < 2) {
+                double newVal = probGenerator();
+                categorical.set(toModify, newVal);
+                categoricalRotate.set(toModify, newVal);
+            } else {
+                while(!categorical.contains(toModify)) toModify = (toModify + 1) % nItems;
+                categorical.remove(toModify);
+                categoricalRotate.remove(toModify);
+            }
+        }
+        if(m > burnIn) {
+            std::vector<double> weights;
+            for(auto &category: categorical.map) weights.push_back(category.getWeight());
+            huffmanTotal += calcHuffmanLength(weights.begin(), weights.end());
+            catTotal += categorical.map.expectedDepth();
+            rotateTotal += categoricalRotate.map.expectedDepth();
+            count += 1;
+        }
+    }
+
+    printf("\t\t%.4f\t\t%.4f\t\t%.4f\t\t%.4f\t\t%.4f\n",
+           huffmanTotal/count,
+           catTotal/count,
+           rotateTotal/count,
+           catTotal/huffmanTotal,
+           rotateTotal/huffmanTotal);
+}
+
+
+int main() {
+    std::uniform_real_distribution<double> uniform;
+    printf("Distribution\tHuffman\t\tCategorical\tRotation\tCat ratio\tRotation ratio\n");
+    printf("Uniform\t");
+    calculatePerformance([&]() { return uniform(rng); });
+
+    printf("Exponential");
+    calculatePerformance([&]() { return -std::log(1.0 - uniform(rng)); });
+
+    printf("Resonance");
+    calculatePerformance([&]() { return uniform(rng) < 0.99 ? 1.0 : 1000.0; });
+    return 0;
+}
@@ -1,22 +1,123 @@
 #include <iostream>
 
 #include "MutableCategorical.h"
+#include "MutableCategoricalKaryArray.h"
+#include "MutableCategoricalAdaptiveArray.h"
+#include "MutableCategoricalRejectionArray.h"
+#include "MutableCategoricalConcurrentArray.h"
+#include "MutableCategoricalRangeArray.h"
 #include "test/TestMutableCategoricalArray.h"
+#include "test/TestMutableCategoricalArraySnapshot.h"
+#include "test/TestMutableCategoricalArrayWithLeafWeights.h"
+#include "test/TestMutableCategoricalAdaptiveArray.h"
+#include "test/TestMutableCategoricalRejectionArray.h"
+#include "test/TestMutableCategoricalConcurrentArray.h"
+#include "test/TestMutableCategoricalRangeArray.h"
 #include "MutableCategoricalMap.h"
+#include "MutableCategoricalCompactMap.h"
 #include "test/TestMutableCategorical.h"
+#include "test/TestMutableCategoricalMap.h"
+#include "test/TestMutableCategoricalHandles.h"
+#include "test/TestMutableCategoricalInstrumentation.h"
+#include "test/TestPhilox4x32.h"
+#include "test/TestGillespieSimulation.h"
+#include "test/TestMutableCategoricalGroups.h"
 
 int main() {
-    std::cout << "Starting MutableCategoricalArray test" << std::endl;
-    TestMutableCategoricalArray arrayTest;
+    std::cout << "Starting Philox4x32 test" << std::endl;
+    TestPhilox4x32 philoxTest;
+    philoxTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalArray test" << std::endl;
+    TestMutableCategoricalArray<MutableCategoricalArray<>> arrayTest;
     arrayTest.doTest();
+    arrayTest.doExtendedTest();
+    TestMutableCategoricalArraySnapshot snapshotTest;
+    snapshotTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalArrayWithLeafWeights test" << std::endl;
+    TestMutableCategoricalArray<MutableCategoricalArrayWithLeafWeights<>> leafWeightsTest;
+    leafWeightsTest.doTest();
+    leafWeightsTest.testBatchSample();
+    leafWeightsTest.testSetMany();
+    leafWeightsTest.testParallelBuild();
+    TestMutableCategoricalArrayWithLeafWeights exactWeightsTest;
+    exactWeightsTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalKaryArray test" << std::endl;
+    TestMutableCategoricalArray<MutableCategoricalKaryArray<8>> karyTest;
+    karyTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalAdaptiveArray test" << std::endl;
+    TestMutableCategoricalArray<MutableCategoricalAdaptiveArray<>> adaptiveTest;
+    adaptiveTest.doTest();
+    adaptiveTest.testBatchSample();
+    adaptiveTest.testSetMany();
+    TestMutableCategoricalAdaptiveArray aliasTableTest;
+    aliasTableTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalRejectionArray test" << std::endl;
+    TestMutableCategoricalArray<MutableCategoricalRejectionArray> rejectionTest;
+    rejectionTest.doTest();
+    TestMutableCategoricalRejectionArray extremeWeightsTest;
+    extremeWeightsTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalConcurrentArray test" << std::endl;
+    TestMutableCategoricalArray<MutableCategoricalConcurrentArray<>> concurrentTest;
+    concurrentTest.doTest();
+    TestMutableCategoricalConcurrentArray concurrentAccessTest;
+    concurrentAccessTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalRangeArray test" << std::endl;
+    TestMutableCategoricalArray<MutableCategoricalRangeArray> rangeTest;
+    rangeTest.doTest();
+    TestMutableCategoricalRangeArray rangeUpdatesTest;
+    rangeUpdatesTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalGroups test" << std::endl;
+    TestMutableCategoricalGroups groupsTest;
+    groupsTest.doTest();
 
     std::cout << std::endl << "Starting MutableCategoricalMap test" << std::endl;
     TestMutableCategorical<MutableCategoricalMap<int>> treeTest;
     treeTest.doTest();
+    TestMutableCategoricalMap<MutableCategoricalMap<int>> mapTest;
+    mapTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalMapWithRotation test" << std::endl;
+    TestMutableCategorical<MutableCategoricalMapWithRotation<int>> rotationTest;
+    rotationTest.doTest();
+    TestMutableCategoricalMap<MutableCategoricalMapWithRotation<int>> rotationMapTest;
+    rotationMapTest.doTest();
+    rotationMapTest.testRotationOrder();
+
+    std::cout << std::endl << "Starting MutableCategoricalCompactMap test" << std::endl;
+    TestMutableCategorical<MutableCategoricalCompactMap<int>> compactTest;
+    compactTest.doTest();
+    TestMutableCategoricalMap<MutableCategoricalCompactMap<int>> compactMapTest;
+    compactMapTest.doTest();
+    compactMapTest.testValueDestruction();
 
     std::cout << std::endl << "Starting MutableCategorical test" << std::endl;
     TestMutableCategorical<MutableCategorical<int>> catTest;
     catTest.doTest();
+    TestMutableCategoricalHandles<MutableCategorical<int>> handleTest;
+    handleTest.doTest();
+
+    std::cout << std::endl << "Starting MutableCategoricalWithIndex test" << std::endl;
+    TestMutableCategorical<MutableCategoricalWithIndex<int>> indexedTest;
+    indexedTest.doTest();
+    TestMutableCategoricalHandles<MutableCategoricalWithIndex<int>> labelTest;
+    labelTest.doTest();
+    labelTest.testLabelIndex();
+
+    std::cout << std::endl << "Starting instrumentation test" << std::endl;
+    TestMutableCategoricalInstrumentation instrumentationTest;
+    instrumentationTest.doTest();
+
+    std::cout << std::endl << "Starting Gillespie simulation test" << std::endl;
+    TestGillespieSimulation gillespieTest;
+    gillespieTest.doTest();
 
     return 0;
 }
@@ -0,0 +1,240 @@
+//
+// Tests of GillespieSimulation
+//
+
+#ifndef CPP_TESTGILLESPIESIMULATION_H
+#define CPP_TESTGILLESPIESIMULATION_H
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../GillespieSimulation.h"
+
+class TestGillespieSimulation {
+public:
+    std::mt19937_64 rng;
+
+    // Immigration at rate birthRate and death of each individual at rate deathRate, whose
+    // stationary distribution is Poisson(birthRate/deathRate)
+    struct BirthDeathModel {
+        static constexpr int BIRTH = 0;
+        static constexpr int DEATH = 1;
+        double birthRate = 20.0;
+        double deathRate = 1.0;
+        int population = 0;
+
+        double rate(int event) const { return event == BIRTH ? birthRate : deathRate * population; }
+        void fire(int event) { if(event == BIRTH) ++population; else if(population > 0) --population; }
+
+        static EventDependencyGraph dependencies() { return EventDependencyGraph({{DEATH}, {DEATH}}); }
+    };
+
+    // Particles hopping left or right, at unit rate per particle, between the sites of a ring.
+    // Event 2i hops a particle left from site i and event 2i+1 hops one right.
+    struct RingModel {
+        std::vector<int> population;
+
+        explicit RingModel(int nSites) : population(nSites) {
+            for(int site = 0; site < nSites; ++site) population[site] = site % 3;
+        }
+
+        int nSites() const { return population.size(); }
+        int destination(int event) const { return (event/2 + ((event & 1) ? 1 : nSites() - 1)) % nSites(); }
+        double rate(int event) const { return population[event/2]; }
+        void fire(int event) {
+            --population[event/2];
+            ++population[destination(event)];
+        }
+
+        EventDependencyGraph dependencies() const {
+            EventDependencyGraph graph;
+            for(int event = 0; event < 2*nSites(); ++event) {
+                int source = event/2;
+                int dest = destination(event);
+                std::vector<int> dependents {2*source, 2*source + 1, 2*dest, 2*dest + 1};
+                graph.addEvent(dependents.begin(), dependents.end());
+            }
+            return graph;
+        }
+    };
+
+    // A model whose rates are set from outside, which records whether an event fired with zero rate
+    struct SettableModel {
+        std::vector<double> rateOf;
+        bool firedZeroRate = false;
+
+        double rate(int event) const { return rateOf[event]; }
+        void fire(int event) { if(!(rateOf[event] > 0.0)) firedZeroRate = true; }
+    };
+
+    void doTest() {
+        testStationaryDistribution();
+        testZeroedRates();
+        testRateUpdates();
+        testLeap();
+        testTrajectoryRecorder();
+    }
+
+    // the population sampled at unit intervals should have the mean and variance of the
+    // stationary Poisson distribution
+    void testStationaryDistribution() {
+        BirthDeathModel model;
+        GillespieSimulation<BirthDeathModel> simulation(model, BirthDeathModel::dependencies());
+        simulation.run(rng, 20.0);
+        const int nSamples = 20000;
+        double sum = 0.0, sumSq = 0.0;
+        for(int sample = 1; sample <= nSamples; ++sample) {
+            simulation.run(rng, 20.0 + sample);
+            sum += model.population;
+            sumSq += model.population * model.population;
+        }
+        assert(simulation.time() == 20.0 + nSamples);
+        double mean = sum / nSamples;
+        double variance = sumSq / nSamples - mean * mean;
+        double expected = model.birthRate / model.deathRate;
+        assert(fabs(mean - expected) < 0.25);
+        assert(fabs(variance - expected) < 0.1 * expected);
+
+        // with all rates zero, nothing fires
+        BirthDeathModel extinct;
+        extinct.birthRate = 0.0;
+        GillespieSimulation<BirthDeathModel> stopped(extinct, BirthDeathModel::dependencies());
+        assert(stopped.step(rng) == -1);
+        assert(stopped.run(rng, 10.0) == 0 && stopped.time() == 10.0);
+        std::cout << "Passed Gillespie stationary distribution test" << std::endl;
+    }
+
+    // Sets all rates to zero one by one, after random updates that leave rounding error in the
+    // sums of the rate tree. No event should fire with zero rate, and once all rates are zero
+    // nothing should fire, even if the tree's sum is left slightly positive.
+    void testZeroedRates() {
+        const int nEvents = 10;
+        std::uniform_real_distribution<double> uniform;
+        int nWithResidue = 0;
+        for(int trial = 0; trial < 1000; ++trial) {
+            SettableModel model{std::vector<double>(nEvents)};
+            for(double &rate: model.rateOf) rate = uniform(rng);
+            GillespieSimulation<SettableModel> simulation(model, EventDependencyGraph(std::vector<std::vector<int>>(nEvents)));
+            for(int update = 0; update < 20; ++update) {
+                int event = std::uniform_int_distribution<int>(0, nEvents - 1)(rng);
+                model.rateOf[event] = uniform(rng);
+                simulation.updateRates(&event, &event + 1);
+            }
+            std::vector<int> order(nEvents);
+            std::iota(order.begin(), order.end(), 0);
+            std::shuffle(order.begin(), order.end(), rng);
+            for(int event: order) {
+                model.rateOf[event] = 0.0;
+                simulation.updateRates(&event, &event + 1);
+                if(event == order.back() && simulation.totalRate() != 0.0) ++nWithResidue;
+                for(int step = 0; step < 10; ++step) simulation.step(rng);
+            }
+            double time = simulation.time();
+            int event = simulation.step(rng);
+            assert(event == -1 && simulation.time() == time);
+            long nFired = simulation.run(rng, time + 1.0);
+            assert(nFired == 0 && simulation.time() == time + 1.0);
+            assert(!model.firedZeroRate);
+        }
+        assert(nWithResidue > 0); // so the redraws and reset have been exercised
+        std::cout << "Passed Gillespie zeroed rates test" << std::endl;
+    }
+
+    // after many steps and leaps, the rate tree should hold the rates of the model
+    void testRateUpdates() {
+        RingModel model(1000);
+        GillespieSimulation<RingModel> simulation(model, model.dependencies());
+        int totalPopulation = 0;
+        for(int n: model.population) totalPopulation += n;
+        for(int step = 0; step < 100000; ++step) assert(simulation.step(rng) >= 0);
+        assert(simulation.nEventsFired() == 100000);
+        for(int leap = 0; leap < 100; ++leap) simulation.leap(rng, 0.01);
+        int finalPopulation = 0;
+        for(int site = 0; site < model.nSites(); ++site) {
+            finalPopulation += model.population[site];
+            assert(fabs(simulation.rates()[2*site] - model.rate(2*site)) < 1e-9);
+        }
+        assert(finalPopulation == totalPopulation);
+        assert(fabs(simulation.totalRate() - 2.0 * totalPopulation) < 1e-6);
+
+        // changing the state from outside
+        model.population[0] += 10;
+        int changed[] = {0, 1};
+        simulation.updateRates(changed, changed + 2);
+        assert(fabs(simulation.rates()[0] - model.rate(0)) < 1e-9);
+        model.population[1] += 10;
+        simulation.resetRates();
+        assert(fabs(simulation.rates()[2] - model.rate(2)) < 1e-9);
+        std::cout << "Passed Gillespie rate update test" << std::endl;
+    }
+
+    // with a small tau, leaping should approximate the stationary mean
+    void testLeap() {
+        BirthDeathModel model;
+        GillespieSimulation<BirthDeathModel> simulation(model, BirthDeathModel::dependencies());
+        const double tau = 0.01;
+        for(int leap = 0; leap < 2000; ++leap) simulation.leap(rng, tau);
+        double sum = 0.0;
+        long nFiredBefore = simulation.nEventsFired();
+        const int nSamples = 10000;
+        for(int sample = 0; sample < nSamples; ++sample) {
+            for(int leap = 0; leap < 100; ++leap) simulation.leap(rng, tau);
+            sum += model.population;
+        }
+        assert(fabs(sum / nSamples - model.birthRate / model.deathRate) < 0.5);
+        // about birthRate births and birthRate deaths per unit time
+        double firedPerTime = (simulation.nEventsFired() - nFiredBefore) / (nSamples * 100 * tau);
+        assert(fabs(firedPerTime - 2.0 * model.birthRate) < 0.05 * 2.0 * model.birthRate);
+        std::cout << "Passed Gillespie tau-leaping test" << std::endl;
+    }
+
+    void testTrajectoryRecorder() {
+        // unbuffered, the recorder holds the whole trajectory
+        BirthDeathModel model;
+        GillespieSimulation<BirthDeathModel, MutableCategoricalArray<double>, TrajectoryRecorder> simulation(model, BirthDeathModel::dependencies());
+        for(int step = 0; step < 1000; ++step) simulation.step(rng);
+        const std::vector<TrajectoryRecorder::Record> &records = simulation.recorder().records();
+        assert(records.size() == 1000);
+        int population = 0;
+        for(size_t r = 0; r < records.size(); ++r) {
+            if(r > 0) assert(records[r].time >= records[r-1].time);
+            population += records[r].event == BirthDeathModel::BIRTH ? 1 : -1;
+        }
+        assert(population == model.population);
+        assert(records.back().time == simulation.time());
+
+        // with a sink, records are streamed a buffer at a time
+        std::ostringstream out;
+        long nFlushed = 0;
+        int nFlushes = 0;
+        {
+            TrajectoryRecorder::sink_type writer = TrajectoryRecorder::writeTo(out);
+            BirthDeathModel streamedModel;
+            GillespieSimulation<BirthDeathModel, MutableCategoricalArray<double>, TrajectoryRecorder> streamed(
+                    streamedModel, BirthDeathModel::dependencies(), 0.0,
+                    TrajectoryRecorder(100, [&](const std::vector<TrajectoryRecorder::Record> &buffer) {
+                        assert(buffer.size() <= 100);
+                        nFlushed += buffer.size();
+                        ++nFlushes;
+                        writer(buffer);
+                    }));
+            for(int step = 0; step < 1050; ++step) streamed.step(rng);
+            assert(nFlushed == 1000 && streamed.recorder().records().size() == 50);
+        }
+        assert(nFlushed == 1050 && nFlushes == 11);
+        std::istringstream in(out.str());
+        std::string line;
+        int nLines = 0;
+        while(std::getline(in, line)) ++nLines;
+        assert(nLines == 1050);
+        std::cout << "Passed Gillespie trajectory recorder test" << std::endl;
+    }
+};
+
+#endif //CPP_TESTGILLESPIESIMULATION_H
@@ -6,6 +6,9 @@
 #define CPP_TESTMUTABLECATEGORICAL_H
 
 #include <map>
+#include <set>
+#include <vector>
+#include <iterator>
 #include <random>
 #include <iostream>
 #include <algorithm>
@@ -26,6 +29,9 @@ public:
     void doTest() {
         testCreation();
         testModification();
+        testSampleDistinct();
+        testSampleExcluding();
+        testQuantiles();
         testDeletion();
     }
 
@@ -56,6 +62,93 @@ public:
     }
 
 
+    void testSampleDistinct() {
+        const int k = 10;
+        const int nDraws = 100000;
+        std::map<int,int> firstDrawCount;
+        for(auto entry: distribution) firstDrawCount[entry] = 0;
+        for(int draw = 0; draw < nDraws; ++draw) {
+            std::vector<typename DIST::iterator> sample;
+            distribution.sampleDistinct(randomSource, k, std::back_inserter(sample));
+            assert(sample.size() == k);
+            std::set<int> distinctValues;
+            for(auto it: sample) distinctValues.insert(*it);
+            assert(distinctValues.size() == k);
+            ++firstDrawCount[*sample.front()];
+        }
+        assert(haveEqualEntries(reference, distribution));
+
+        // the first draw should have the ordinary distribution
+        double chiSq = 0.0;
+        for(auto it = distribution.begin(); it != distribution.end(); ++it) {
+            double expectedCount = distribution.probability(it) * nDraws;
+            double sampleError = firstDrawCount[*it] - expectedCount;
+            chiSq += sampleError*sampleError / expectedCount;
+        }
+        assert(!pValueIsLessThan(chiSq, distribution.size()-1, 0.0001));
+
+        // asking for more than all categories gives every category once
+        const DIST &constDistribution = distribution;
+        std::vector<typename DIST::const_iterator> all;
+        constDistribution.sampleDistinct(randomSource, distribution.size() + 10, std::back_inserter(all));
+        std::set<int> allValues;
+        for(auto it: all) allValues.insert(*it);
+        assert(all.size() == distribution.size() && allValues.size() == distribution.size());
+        std::cout << "Passed sampleDistinct test" << std::endl;
+    }
+
+
+    // draws should never give the excluded category, and the others in proportion to their weights
+    void testSampleExcluding() {
+        const DIST &constDistribution = distribution;
+        auto excluded = constDistribution.begin();
+        for(int i = 0; i < distribution.size() / 3; ++i) ++excluded;
+        const int nDraws = 100000;
+        std::map<int,int> drawCount;
+        for(int draw = 0; draw < nDraws; ++draw) {
+            auto category = constDistribution.sampleExcluding(randomSource, excluded);
+            assert(category != constDistribution.end() && category != excluded);
+            ++drawCount[*category];
+        }
+        double remainingWeight = distribution.sum() - distribution.weight(excluded);
+        double chiSq = 0.0;
+        for(auto it = constDistribution.begin(); it != constDistribution.end(); ++it) {
+            if(it == excluded) continue;
+            double expectedCount = distribution.weight(it) / remainingWeight * nDraws;
+            double sampleError = drawCount[*it] - expectedCount;
+            chiSq += sampleError*sampleError / expectedCount;
+        }
+        assert(!pValueIsLessThan(chiSq, distribution.size()-2, 0.0001));
+
+        // with nothing else to draw, there's no category
+        DIST single;
+        auto only = single.add(1, 1.0);
+        assert(single.sampleExcluding(randomSource, only) == single.end());
+        single.add(2, 0.0);
+        assert(single.sampleExcluding(randomSource, only) == single.end());
+        std::cout << "Passed sampleExcluding test" << std::endl;
+    }
+
+    // the cumulative distribution should follow the order of iteration
+    void testQuantiles() {
+        double cumulativeWeight = 0.0;
+        for(auto it = distribution.begin(); it != distribution.end(); ++it) {
+            assert(fabs(distribution.prefixSum(it) - cumulativeWeight) < 1e-9);
+            assert(distribution.findByCumulative(cumulativeWeight + 0.5 * distribution.weight(it)) == it);
+            cumulativeWeight += distribution.weight(it);
+        }
+
+        std::vector<double> u(10000);
+        for(double &ui: u) ui = std::uniform_real_distribution<double>()(randomSource);
+        std::sort(u.begin(), u.end());
+        std::vector<typename DIST::iterator> merged;
+        distribution.quantiles(u.begin(), u.end(), std::back_inserter(merged));
+        assert(merged.size() == u.size());
+        for(int j = 0; j < u.size(); ++j) assert(merged[j] == distribution.quantile(u[j]));
+        std::cout << "Passed quantiles test" << std::endl;
+    }
+
+
     void testDeletion() {
         while(distribution.size() > 0) {
             auto it = distribution(randomSource);
@@ -0,0 +1,37 @@
+//
+// Tests of features specific to MutableCategoricalAdaptiveArray
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALADAPTIVEARRAY_H
+#define CPP_TESTMUTABLECATEGORICALADAPTIVEARRAY_H
+
+#include <vector>
+#include "TestMutableCategoricalArray.h"
+#include "../MutableCategoricalAdaptiveArray.h"
+
+class TestMutableCategoricalAdaptiveArray: public TestMutableCategoricalArray<MutableCategoricalAdaptiveArray<>> {
+public:
+
+    void doTest() {
+        testAliasTable();
+    }
+
+    // checks that the alias table is built when draws dominate, is discarded on modification,
+    // and never draws zero weight categories
+    void testAliasTable() {
+        MutableCategoricalAdaptiveArray<> dist {0.0, 0.0, 1.0, 0.0, 3.0, 0.0};
+        assert(!dist.hasAliasTable());
+        std::vector<int> histogram(dist.size(), 0);
+        for(int i=0; i<100000; ++i) histogram[dist(rng)] += 1;
+        assert(dist.hasAliasTable());
+        assert(histogram[0] + histogram[1] + histogram[3] + histogram[5] == 0);
+        testHistogram(dist, histogram, 100000);
+        dist[1] = 2.0;
+        assert(!dist.hasAliasTable());
+        testDistribution(dist, 100000);
+        assert(dist.hasAliasTable());
+        std::cout << "Passed AliasTable test" << std::endl;
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALADAPTIVEARRAY_H
@@ -3,10 +3,20 @@
 
 
 #include <assert.h>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+#include <cmath>
 
 #include "../MutableCategoricalArray.h"
+#include "../Philox4x32.h"
 #include "ChiSquaredTest.h"
 
+// ARRAY is the array class to test, it should implement the interface of MutableCategoricalArray.
+// doTest() tests the common interface, while doExtendedTest() tests features that only
+// MutableCategoricalArray provides.
+template<class ARRAY>
 class TestMutableCategoricalArray {
 public:
     std::default_random_engine rng;
@@ -16,29 +26,46 @@ public:
         testInitialization();
         testTriangular();
         testModification();
+        testPushAndPop();
+    }
+
+    void doExtendedTest() {
+        testBatchSample();
+        testSetMany();
+        testWeightTypes();
+        testParallelBuild();
+        testSampleDistinct();
+        testQuantiles();
+        testSample64();
+        testSampleInRange();
     }
 
     void testOddCases() {
         //singleton
-        MutableCategoricalArray dist1 {0.1};
+        ARRAY dist1 {0.1};
         assert(dist1(rng) == 0);
 
         // zero probs
-        MutableCategoricalArray dist2 {0.0, 0.0, 1.0, 0.0, 0.0, 0.0};
+        ARRAY dist2 {0.0, 0.0, 1.0, 0.0, 0.0, 0.0};
         assert(dist2(rng) == 2);
         std::cout << "Passed OddCases test" << std::endl;
     }
 
     void testInitialization() {
-        MutableCategoricalArray myDistribution{0.4,0.6};
+        ARRAY myDistribution{0.4,0.6};
         assert(myDistribution[0] == 0.4);
         assert(myDistribution[1] == 0.6);
+
+        std::vector<double> weights = {0.1, 0.2, 0.3, 0.4, 0.5};
+        ARRAY fromRange(weights.begin(), weights.end());
+        assert(haveEqualWeights(fromRange, weights));
+        testDistribution(fromRange, weights, 100000);
         std::cout << "Passed initialisation test" << std::endl;
     }
 //
     void testTriangular() {
         int N = 10;
-        MutableCategoricalArray triangularDistribution(N,[](int i) { return i; });
+        ARRAY triangularDistribution(N,[](int i) { return i; });
         testDistribution(triangularDistribution, 1000000);
         std::cout << "Passed Triangular distribution test" << std::endl;
     }
@@ -51,7 +78,7 @@ public:
         for(int i=0; i<N; ++i) {
             targetDist[i] = uniformDist(rng);
         }
-        MutableCategoricalArray testDist(N, [&targetDist](int i){ return targetDist[i]; });
+        ARRAY testDist(N, [&targetDist](int i){ return targetDist[i]; });
         for(int i=0; i<100; ++i) {
             testDistribution(testDist, targetDist, 100000);
             int index = indexDist(rng);
@@ -62,12 +89,273 @@ public:
         std::cout << "Passed Modification test" << std::endl;
     }
 
-    void testDistribution(MutableCategoricalArray dist, int nSamples) {
+    void testPushAndPop() {
+        int N = 100;
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        std::vector<double> targetDist;
+        ARRAY testDist;
+        for(int i=0; i<N; ++i) {
+            targetDist.push_back(uniformDist(rng));
+            testDist.push_back(targetDist.back());
+            assert(haveEqualWeights(testDist, targetDist));
+        }
+        testDistribution(testDist, targetDist, 100000);
+        while(testDist.size() > 1) {
+            targetDist.pop_back();
+            testDist.pop_back();
+            assert(haveEqualWeights(testDist, targetDist));
+        }
+        assert(testDist(rng) == 0);
+        std::cout << "Passed PushAndPop test" << std::endl;
+    }
+
+    void testBatchSample() {
+        int N = 1000;
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        ARRAY testDist(N, [&](int i){ return uniformDist(rng); });
+        int nSamples = 1000000;
+        std::vector<int> samples(nSamples);
+        std::vector<int>::iterator samplesEnd = testDist.sample(rng, nSamples, samples.begin());
+        assert(samplesEnd == samples.end());
+        std::vector<int> histogram(testDist.size(),0);
+        for(int sample: samples) histogram[sample] += 1;
+        testHistogram(testDist, histogram, nSamples);
+
+        // number of samples not a multiple of the number of lanes
+        std::vector<int> oddSamples;
+        testDist.sample(rng, 13, std::back_inserter(oddSamples));
+        assert(oddSamples.size() == 13);
+        std::cout << "Passed Batch sample test" << std::endl;
+    }
+
+    void testSetMany() {
+        int N = 1000;
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        std::uniform_int_distribution<int> indexDist(0,N-1);
+        ARRAY sequential(N, [&](int i){ return uniformDist(rng); });
+        for(int nUpdates : {1, 10, 50, 2000}) { // sparse and dense
+            ARRAY bulk = sequential;
+            std::vector<int> indices;
+            std::vector<double> weights;
+            for(int j=0; j<nUpdates; ++j) {
+                indices.push_back(indexDist(rng));
+                weights.push_back(uniformDist(rng));
+                sequential.set(indices.back(), weights.back());
+            }
+            bulk.setMany(indices, weights);
+            for(int i=0; i<N; ++i) assert(fabs(bulk[i] - sequential[i]) < 1e-12);
+            assert(fabs(bulk.sum() - sequential.sum()) < 1e-10);
+        }
+
+        std::vector<std::pair<int,double>> updates = {{3, 0.5}, {999, 0.25}, {3, 0.75}, {0, 1.0}};
+        ARRAY bulk = sequential;
+        bulk.setMany(updates.begin(), updates.end());
+        for(auto update: updates) sequential.set(update.first, update.second);
+        for(int i=0; i<N; ++i) assert(fabs(bulk[i] - sequential[i]) < 1e-12);
+        assert(fabs(bulk[3] - 0.75) < 1e-12);
+        std::cout << "Passed SetMany test" << std::endl;
+    }
+
+    // integer weights should stay exact however many times they're modified
+    void testWeightTypes() {
+        int N = 100;
+        std::uniform_int_distribution<uint64_t> countDist(0, 1000000);
+        std::uniform_int_distribution<int> indexDist(0, N-1);
+        std::vector<uint64_t> counts(N);
+        for(uint64_t &count: counts) count = countDist(rng);
+        MutableCategoricalArray<uint64_t> integerDist(N, [&counts](int i) { return counts[i]; });
+        for(int j=0; j<100000; ++j) {
+            int index = indexDist(rng);
+            counts[index] = countDist(rng);
+            integerDist.set(index, counts[index]);
+        }
+        uint64_t sum = 0;
+        for(int i=0; i<N; ++i) {
+            assert(integerDist[i] == counts[i]);
+            sum += counts[i];
+        }
+        assert(integerDist.sum() == sum);
+        testDistribution(integerDist, 1000000);
+
+        MutableCategoricalArray<float> floatDist(N, [&counts](int i) { return counts[i] * 1e-6f; });
+        testDistribution(floatDist, 1000000);
+        std::cout << "Passed WeightTypes test" << std::endl;
+    }
+
+    // building on several threads should give exactly the same tree as building on one
+    void testParallelBuild() {
+        int N = 3 * (1 << 20) + 12345;
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        std::vector<double> weights(N);
+        for(double &weight: weights) weight = uniformDist(rng);
+        ARRAY serial(N, [&weights](int i) { return weights[i]; });
+        for(int nThreads : {2, 3, 8}) {
+            ARRAY parallel(N, [&weights](int i) { return weights[i]; }, nThreads);
+            assert(parallel.sum() == serial.sum());
+            for(int i=0; i<N; ++i) assert(parallel[i] == serial[i]);
+        }
+        ARRAY fromRange(weights.begin(), weights.end());
+        ARRAY reset(N);
+        reset.setAll(weights);
+        for(int i=0; i<N; ++i) assert(fromRange[i] == serial[i] && reset[i] == serial[i]);
+        assert(fromRange.sum() == serial.sum() && reset.sum() == serial.sum());
+        std::cout << "Passed ParallelBuild test" << std::endl;
+    }
+
+    // sampleInRange() and sampleExcluding() should draw as if the other weights were zero
+    void testSampleInRange() {
+        int N = 1000;
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        const ARRAY dist(N, [&](int i) { return i % 7 == 0 ? 0.0 : uniformDist(rng); });
+        int nSamples = 100000;
+        for(std::pair<int,int> range: {std::pair(0, N), std::pair(100, 300), std::pair(999, 1000), std::pair(0, 1)}) {
+            ARRAY restricted(N, [&](int i) { return i >= range.first && i < range.second ? dist[i] : 0.0; });
+            if(restricted.sum() == 0.0) {
+                assert(dist.sampleInRange(rng, range.first, range.second) == -1);
+                continue;
+            }
+            std::vector<int> histogram(N, 0);
+            for(int s = 0; s < nSamples; ++s) histogram[dist.sampleInRange(rng, range.first, range.second)] += 1;
+            testHistogram(restricted, histogram, nSamples);
+        }
+
+        for(int excluded: {0, 1, 500, N-1}) {
+            ARRAY others(N, [&](int i) { return i == excluded ? 0.0 : dist[i]; });
+            std::vector<int> histogram(N, 0);
+            for(int s = 0; s < nSamples; ++s) histogram[dist.sampleExcluding(rng, excluded)] += 1;
+            assert(histogram[excluded] == 0);
+            testHistogram(others, histogram, nSamples);
+        }
+
+        MutableCategoricalArray<uint64_t> integerDist{0, 3, 0, 5};
+        for(int s = 0; s < 1000; ++s) {
+            assert(integerDist.sampleExcluding(rng, 3) == 1);
+            assert(integerDist.sampleInRange(rng, 2, 4) == 3);
+        }
+        assert(integerDist.sampleInRange(rng, 2, 3) == -1);
+        MutableCategoricalArray<uint64_t> single{7};
+        assert(single.sampleExcluding(rng, 0) == -1);
+        std::cout << "Passed sampleInRange test" << std::endl;
+    }
+
+    // ordered pairs drawn without replacement should have probability w_i/W * w_j/(W - w_i)
+    void testSampleDistinct() {
+        const ARRAY dist{1.0, 2.0, 3.0, 4.0, 0.0, 5.0, 6.0};
+        int n = dist.size();
+        int nSamples = 200000;
+        std::vector<int> histogram(n*n, 0);
+        for(int s = 0; s < nSamples; ++s) {
+            int pair[2];
+            int *pairEnd = dist.sampleDistinct(rng, 2, pair);
+            assert(pairEnd == pair + 2);
+            assert(pair[0] != pair[1]);
+            ++histogram[pair[0]*n + pair[1]];
+        }
+        double chiSq = 0.0;
+        int nPossiblePairs = 0;
+        for(int i = 0; i < n; ++i) {
+            for(int j = 0; j < n; ++j) {
+                double p = (i == j) ? 0.0 : dist.P(i) * dist[j] / (dist.sum() - dist[i]);
+                if(p > 0.0) {
+                    ++nPossiblePairs;
+                    double sampleError = histogram[i*n + j] - p*nSamples;
+                    chiSq += sampleError*sampleError / (p*nSamples);
+                } else {
+                    assert(histogram[i*n + j] == 0);
+                }
+            }
+        }
+        assert(!pValueIsLessThan(chiSq, nPossiblePairs - 1, 0.0001));
+
+        // asking for more categories than have non-zero weight gives all of them
+        std::vector<int> all;
+        dist.sampleDistinct(rng, 100, std::back_inserter(all));
+        std::sort(all.begin(), all.end());
+        assert((all == std::vector<int>{0, 1, 2, 3, 5, 6}));
+        assert(dist.sum() == 21.0);
+        std::cout << "Passed sampleDistinct test" << std::endl;
+    }
+
+    // findByCumulative() and prefixSum() should be inverses, in order of index, and quantiles()
+    // should give the same as quantile() on each u
+    void testQuantiles() {
+        int N = 1000;
+        std::uniform_int_distribution<uint64_t> countDist(0, 1000);
+        MutableCategoricalArray<uint64_t> integerDist(N, [&](int i) { return countDist(rng); });
+        assert(integerDist.prefixSum(0) == 0 && integerDist.prefixSum(N) == integerDist.sum());
+        for(int i = 0; i < N; ++i) {
+            assert(integerDist.prefixSum(i+1) - integerDist.prefixSum(i) == integerDist[i]);
+            if(integerDist[i] > 0) {
+                assert(integerDist.findByCumulative(integerDist.prefixSum(i)) == i);
+                assert(integerDist.findByCumulative(integerDist.prefixSum(i+1) - 1) == i);
+            }
+        }
+
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        ARRAY dist(N, [&](int i) { return i % 7 == 0 ? 0.0 : uniformDist(rng); });
+        std::vector<double> u(100000);
+        for(double &ui: u) ui = uniformDist(rng);
+        std::vector<int> histogram(N, 0);
+        for(double ui: u) histogram[dist.quantile(ui)] += 1;
+        testHistogram(dist, histogram, u.size());
+
+        std::sort(u.begin(), u.end());
+        std::vector<int> merged;
+        dist.quantiles(u.begin(), u.end(), std::back_inserter(merged));
+        assert(merged.size() == u.size());
+        for(int j = 0; j < u.size(); ++j) assert(merged[j] == dist.quantile(u[j]));
+        assert(std::is_sorted(merged.begin(), merged.end()));
+        std::cout << "Passed quantiles test" << std::endl;
+    }
+
+    // sample64() should have the right distribution, for floating point and integer weights,
+    // and the extreme words should never give a category of zero weight
+    void testSample64() {
+        int N = 1000;
+        Philox4x32 philox(1234, 5);
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        ARRAY dist(N, [&](int i) { return i % 7 == 0 ? 0.0 : uniformDist(rng); });
+        std::vector<int> histogram(N, 0);
+        int nSamples = 1000000;
+        for(int s = 0; s < nSamples; ++s) histogram[dist.sample64(philox)] += 1;
+        testHistogram(dist, histogram, nSamples);
+
+        std::uniform_int_distribution<uint32_t> countDist(0, 1000);
+        MutableCategoricalArray<uint32_t> integerDist(N, [&](int i) { return i % 7 == 0 ? 0 : countDist(rng); });
+        std::fill(histogram.begin(), histogram.end(), 0);
+        std::mt19937_64 mersenne;
+        for(int s = 0; s < nSamples; ++s) histogram[integerDist.sample64(mersenne)] += 1;
+        testHistogram(integerDist, histogram, nSamples);
+
+        MutableCategoricalArray<float> floatDist{0.0f, 0.1f, 0.7f, 0.0f};
+        for(uint64_t bits: {uint64_t(0), std::numeric_limits<uint64_t>::max()}) {
+            assert(dist[dist.sampleFromBits(bits)] > 0.0);
+            assert(integerDist[integerDist.sampleFromBits(bits)] > 0);
+            assert(floatDist[floatDist.sampleFromBits(bits)] > 0.0f);
+        }
+        std::cout << "Passed sample64 test" << std::endl;
+    }
+
+    // draws from an array whose weights have all been set to zero, leaving rounding error in
+    // its sum, for arrays that return -1 when there's nothing to draw
+    int drawAfterZeroing() {
+        ARRAY zeroed{0.1, 0.2};
+        zeroed.set(0, 0.0);
+        zeroed.set(1, 0.0);
+        return zeroed(rng);
+    }
+
+    template<class DIST>
+    void testDistribution(const DIST &dist, int nSamples) {
         std::vector<int> histogram(dist.size(),0);
         for(int i=0; i<nSamples; ++i) {
             histogram[dist(rng)] += 1;
         }
+        testHistogram(dist, histogram, nSamples);
+    }
 
+    template<class DIST>
+    void testHistogram(const DIST &dist, const std::vector<int> &histogram, int nSamples) {
         double chiSq = 0.0;
         for(int i=0; i<dist.size(); ++i) {
             double expectedCount = dist.P(i) * nSamples;
@@ -79,7 +367,18 @@ public:
         assert(!pValueIsLessThan(chiSq, dist.size()-1, 0.0001));
     }
 
-    void testDistribution(MutableCategoricalArray dist, std::vector<double> targetPMF, int nSamples) {
+    template<class DIST>
+    bool haveEqualWeights(const DIST &dist, const std::vector<double> &weights) {
+        if(dist.size() != weights.size()) return false;
+        double sum = 0.0;
+        for(int i=0; i<weights.size(); ++i) {
+            if(fabs(dist[i] - weights[i]) > 1e-12) return false;
+            sum += weights[i];
+        }
+        return fabs(dist.sum() - sum) < 1e-10;
+    }
+
+    void testDistribution(ARRAY dist, std::vector<double> targetPMF, int nSamples) {
         assert(dist.size() == targetPMF.size());
         double targetSum = 0.0;
         for(int i=0; i<targetPMF.size(); ++i) targetSum += targetPMF[i];
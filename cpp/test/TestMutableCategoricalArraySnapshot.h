@@ -0,0 +1,136 @@
+//
+// Tests of writing, reading and mapping MutableCategoricalArray snapshots
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALARRAYSNAPSHOT_H
+#define CPP_TESTMUTABLECATEGORICALARRAYSNAPSHOT_H
+
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <filesystem>
+#include "TestMutableCategoricalArray.h"
+#include "../MutableCategoricalArraySnapshot.h"
+
+class TestMutableCategoricalArraySnapshot {
+public:
+    std::default_random_engine rng;
+    std::string snapshotPath = (std::filesystem::temp_directory_path() / "TestMutableCategoricalArraySnapshot.bin").string();
+    std::string streamedPath = (std::filesystem::temp_directory_path() / "TestMutableCategoricalArraySnapshotStreamed.bin").string();
+
+    void doTest() {
+        int N = 200017; // more than one Writer buffer
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        std::vector<double> weights(N);
+        for(double &weight: weights) weight = uniformDist(rng);
+        MutableCategoricalArray<> distribution(N, [&weights](int i) { return weights[i]; });
+
+        testReadAndWrite(distribution);
+        testStreamingWriter(weights);
+        testMapping(distribution, weights);
+        testBadSnapshot();
+        std::filesystem::remove(snapshotPath);
+        std::filesystem::remove(streamedPath);
+    }
+
+    void testReadAndWrite(const MutableCategoricalArray<> &distribution) {
+        std::ofstream out(snapshotPath, std::ios::binary);
+        MutableCategoricalArraySnapshot<>::write(distribution, out);
+        out.close();
+        std::ifstream in(snapshotPath, std::ios::binary);
+        MutableCategoricalArray<> loaded = MutableCategoricalArraySnapshot<>::read(in);
+        assert(loaded.size() == distribution.size());
+        assert(loaded.sum() == distribution.sum());
+        for(int i=0; i<distribution.size(); ++i) assert(loaded[i] == distribution[i]);
+        std::cout << "Passed snapshot read and write test" << std::endl;
+    }
+
+    // the streamed snapshot should be byte for byte the same as the one from write()
+    void testStreamingWriter(const std::vector<double> &weights) {
+        {
+            std::ofstream out(streamedPath, std::ios::binary);
+            MutableCategoricalArraySnapshot<>::Writer writer(out);
+            for(double weight: weights) writer.push_back(weight);
+            writer.close();
+        }
+        assert(fileContents(streamedPath) == fileContents(snapshotPath));
+
+        std::stringstream emptySnapshot;
+        MutableCategoricalArraySnapshot<>::Writer(emptySnapshot).close();
+        assert(MutableCategoricalArraySnapshot<>::read(emptySnapshot).size() == 0);
+        std::cout << "Passed snapshot streaming writer test" << std::endl;
+    }
+
+    void testMapping(const MutableCategoricalArray<> &distribution, const std::vector<double> &weights) {
+        auto mapped = MutableCategoricalArraySnapshot<>::map(snapshotPath);
+        assert(mapped.size() == distribution.size());
+        assert(mapped.sum() == distribution.sum());
+        for(int i=0; i<distribution.size(); ++i) assert(mapped[i] == distribution[i]);
+        TestMutableCategoricalArray<MutableCategoricalArray<>> arrayTest;
+        arrayTest.testDistribution(mapped, 1000000);
+
+        std::string original = fileContents(snapshotPath);
+        auto copyOnWrite = MutableCategoricalArraySnapshot<>::map(snapshotPath, MutableCategoricalArraySnapshot<>::COPY_ON_WRITE);
+        copyOnWrite.set(7, 100.0);
+        copyOnWrite.set(distribution.size() - 1, 0.0);
+        assert(copyOnWrite[7] == 100.0);
+        assert(fabs(copyOnWrite.sum() - (distribution.sum() + 100.0 - weights[7] - weights.back())) < 1e-8);
+        assert(mapped[7] == distribution[7]);
+        assert(fileContents(snapshotPath) == original);
+        std::cout << "Passed snapshot mapping test" << std::endl;
+    }
+
+    void testBadSnapshot() {
+        std::stringstream notASnapshot("This is definitely not a snapshot of a MutableCategoricalArray");
+        bool threw = false;
+        try {
+            MutableCategoricalArraySnapshot<>::read(notASnapshot);
+        } catch(const std::runtime_error &error) {
+            threw = true;
+        }
+        assert(threw);
+
+        threw = false;
+        try {
+            MutableCategoricalArraySnapshot<float>::map(snapshotPath);
+        } catch(const std::runtime_error &error) {
+            threw = true;
+        }
+        assert(threw);
+
+        // a header whose nCategories is too large, or larger than the data
+        for(uint64_t nCategories : {(uint64_t(1) << 61) + 1, uint64_t(INT_MAX) + 1, uint64_t(INT_MAX)}) {
+            MutableCategoricalArraySnapshot<>::Header header(nCategories);
+            std::string truncated(reinterpret_cast<const char *>(&header), sizeof(header));
+            truncated.append(sizeof(double), '\0');
+            std::stringstream truncatedStream(truncated);
+            threw = false;
+            try {
+                MutableCategoricalArraySnapshot<>::read(truncatedStream);
+            } catch(const std::runtime_error &error) {
+                threw = true;
+            }
+            assert(threw);
+
+            std::ofstream(streamedPath, std::ios::binary) << truncated;
+            threw = false;
+            try {
+                MutableCategoricalArraySnapshot<>::map(streamedPath);
+            } catch(const std::runtime_error &error) {
+                threw = true;
+            }
+            assert(threw);
+        }
+        std::cout << "Passed bad snapshot test" << std::endl;
+    }
+
+    static std::string fileContents(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALARRAYSNAPSHOT_H
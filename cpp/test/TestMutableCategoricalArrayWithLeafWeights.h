@@ -0,0 +1,59 @@
+//
+// Tests of features specific to MutableCategoricalArrayWithLeafWeights
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALARRAYWITHLEAFWEIGHTS_H
+#define CPP_TESTMUTABLECATEGORICALARRAYWITHLEAFWEIGHTS_H
+
+#include <vector>
+#include <cmath>
+#include "TestMutableCategoricalArray.h"
+
+class TestMutableCategoricalArrayWithLeafWeights: public TestMutableCategoricalArray<MutableCategoricalArrayWithLeafWeights<>> {
+public:
+
+    void doTest() {
+        testLeafWeights();
+    }
+
+    // weights should read back exactly as they were set, whatever the other weights, and the
+    // tree should match one without leaf weights
+    void testLeafWeights() {
+        MutableCategoricalArrayWithLeafWeights<> dist{1e20, 1e-5, 3.0};
+        assert(dist[1] == 1e-5);
+        dist.set(1, 2e-7);
+        dist.set(2, 1e-300);
+        assert(dist[1] == 2e-7 && dist[2] == 1e-300 && dist[0] == 1e20);
+
+        int N = 1000;
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        std::uniform_int_distribution<int> indexDist(0, N-1);
+        std::vector<double> weights(N);
+        for(double &weight: weights) weight = uniformDist(rng);
+        MutableCategoricalArrayWithLeafWeights<> leafDist(weights.begin(), weights.end());
+        MutableCategoricalArray<> plainDist(weights.begin(), weights.end());
+        for(int j = 0; j < 10000; ++j) {
+            int index = indexDist(rng);
+            weights[index] = uniformDist(rng);
+            leafDist.set(index, weights[index]);
+            plainDist.set(index, weights[index]);
+        }
+        std::vector<int> indices = {3, 999, 3, 500};
+        std::vector<double> newWeights = {0.1, 0.2, 0.3, 0.4};
+        leafDist.setMany(indices, newWeights);
+        plainDist.setMany(indices, newWeights);
+        for(size_t j = 0; j < indices.size(); ++j) weights[indices[j]] = newWeights[j];
+        leafDist.push_back(0.5);
+        leafDist.push_back(0.25);
+        leafDist.pop_back();
+        plainDist.push_back(0.5);
+        weights.push_back(0.5);
+        for(size_t i = 0; i < weights.size(); ++i) assert(leafDist[i] == weights[i]);
+        assert(haveEqualWeights(plainDist, weights));
+        assert(fabs(leafDist.sum() - plainDist.sum()) < 1e-10);
+        testDistribution(leafDist, weights, 100000);
+        std::cout << "Passed LeafWeights test" << std::endl;
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALARRAYWITHLEAFWEIGHTS_H
@@ -0,0 +1,70 @@
+//
+// Tests of features specific to MutableCategoricalConcurrentArray
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALCONCURRENTARRAY_H
+#define CPP_TESTMUTABLECATEGORICALCONCURRENTARRAY_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "TestMutableCategoricalArray.h"
+#include "../MutableCategoricalConcurrentArray.h"
+
+class TestMutableCategoricalConcurrentArray: public TestMutableCategoricalArray<MutableCategoricalConcurrentArray<>> {
+public:
+
+    void doTest() {
+        testConcurrentAccess();
+    }
+
+    // sets weights from several threads while other threads draw, then checks that the final
+    // weights are correct, and that there's nothing to draw once all weights are zero
+    void testConcurrentAccess() {
+        const int N = 1000;
+        const int nWriters = 4;
+        const int nReaders = 4;
+        MutableCategoricalConcurrentArray<> dist(N, [](int) { return 1.0; });
+        std::vector<double> finalWeights(N);
+        std::atomic<bool> finishedWriting(false);
+        std::vector<std::thread> threads;
+        for(int writer = 0; writer < nWriters; ++writer) {
+            threads.emplace_back([&, writer]() {
+                std::mt19937 writerRng(writer);
+                std::uniform_real_distribution<double> uniformDist(0.5, 1.0);
+                for(int j = 0; j < 20000; ++j) {
+                    int index = j % (N / nWriters) * nWriters + writer; // each writer has its own indices
+                    finalWeights[index] = uniformDist(writerRng);
+                    dist.set(index, finalWeights[index]);
+                    // doesn't change the weight, but contends with other writers for the ancestors. The index
+                    // must be this writer's own, or another writer's set() could come between the get() and set()
+                    int unchangedIndex = (j * 7) % (N / nWriters) * nWriters + writer;
+                    dist.set(unchangedIndex, dist.get(unchangedIndex));
+                }
+            });
+        }
+        std::atomic<bool> drawsInRange(true);
+        for(int reader = 0; reader < nReaders; ++reader) {
+            threads.emplace_back([&, reader]() {
+                std::mt19937 readerRng(nWriters + reader);
+                while(!finishedWriting) {
+                    int index = dist(readerRng);
+                    if(index < 0 || index >= N) drawsInRange = false;
+                }
+            });
+        }
+        for(int writer = 0; writer < nWriters; ++writer) threads[writer].join();
+        finishedWriting = true;
+        for(size_t reader = nWriters; reader < threads.size(); ++reader) threads[reader].join();
+        assert(drawsInRange);
+        assert(haveEqualWeights(dist, finalWeights));
+        testDistribution(dist, finalWeights, 100000);
+
+        // with all weights zero but rounding error left in the sum, there's nothing to draw
+        int drawn = drawAfterZeroing();
+        assert(drawn == -1);
+        std::cout << "Passed ConcurrentAccess test" << std::endl;
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALCONCURRENTARRAY_H
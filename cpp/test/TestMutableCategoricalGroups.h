@@ -0,0 +1,144 @@
+//
+// Tests of MutableCategoricalGroups
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALGROUPS_H
+#define CPP_TESTMUTABLECATEGORICALGROUPS_H
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../MutableCategoricalGroups.h"
+#include "ChiSquaredTest.h"
+
+class TestMutableCategoricalGroups {
+public:
+    std::mt19937 rng;
+    const int nGroups = 50;
+    const int nInitItems = 2000;
+    MutableCategoricalGroups<> distribution;
+    std::vector<double> weights;    // reference weights of items, by id
+    std::vector<int> groupOf;       // reference group of items, by id, -1 if erased
+
+    void doTest() {
+        testModification();
+        testSampling();
+        testCompaction();
+    }
+
+    // random adds, sets, moves and erases should keep the group sums consistent
+    void testModification() {
+        distribution = MutableCategoricalGroups<>(nGroups);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        std::uniform_int_distribution<int> groupDist(0, nGroups - 1);
+        for(int i = 0; i < nInitItems; ++i) addItem(groupDist(rng), uniform(rng));
+        for(int op = 0; op < 20000; ++op) {
+            int item = std::uniform_int_distribution<int>(0, weights.size() - 1)(rng);
+            if(groupOf[item] == -1) continue;
+            switch(op % 4) {
+                case 0:
+                    weights[item] = uniform(rng);
+                    distribution.set(item, weights[item]);
+                    break;
+                case 1:
+                    groupOf[item] = groupDist(rng);
+                    distribution.move(item, groupOf[item]);
+                    break;
+                case 2:
+                    distribution.erase(item);
+                    groupOf[item] = -1;
+                    break;
+                default:
+                    addItem(groupDist(rng), uniform(rng));
+            }
+        }
+        assertConsistent();
+        std::cout << "Passed MutableCategoricalGroups modification test" << std::endl;
+    }
+
+    // draws of items and of items within a group should be in proportion to their weights
+    void testSampling() {
+        const int nSamples = 1000000;
+        std::vector<int> histogram(weights.size(), 0);
+        for(int s = 0; s < nSamples; ++s) histogram[distribution(rng)] += 1;
+        testHistogram(histogram, nSamples, -1);
+
+        int group = 7;
+        std::fill(histogram.begin(), histogram.end(), 0);
+        for(int s = 0; s < nSamples/10; ++s) histogram[distribution.sampleInGroup(rng, group)] += 1;
+        testHistogram(histogram, nSamples/10, group);
+
+        MutableCategoricalGroups<> empty(3);
+        assert(empty(rng) == -1);
+        int only = empty.add(2, 0.5);
+        assert(empty(rng) == only && empty.sampleGroup(rng) == 2);
+        std::cout << "Passed MutableCategoricalGroups sampling test" << std::endl;
+    }
+
+    // moving items back and forth abandons slices of the arena, which should be reclaimed
+    void testCompaction() {
+        for(int round = 0; round < 20; ++round) {
+            for(int item = 0; item < weights.size(); ++item) {
+                if(groupOf[item] == -1) continue;
+                groupOf[item] = (groupOf[item] + round + 1) % nGroups;
+                distribution.move(item, groupOf[item]);
+            }
+        }
+        assertConsistent();
+        int nItems = 0;
+        for(int g: groupOf) if(g != -1) ++nItems;
+        assert(distribution.arenaSize() < 4 * (2 * nItems + 4 * nGroups));
+        distribution.compact();
+        assertConsistent();
+        std::cout << "Passed MutableCategoricalGroups compaction test" << std::endl;
+    }
+
+    void addItem(int group, double weight) {
+        int item = distribution.add(group, weight);
+        assert(item == weights.size());
+        weights.push_back(weight);
+        groupOf.push_back(group);
+    }
+
+    void assertConsistent() {
+        std::vector<double> groupSums(nGroups, 0.0);
+        std::vector<int> groupSizes(nGroups, 0);
+        double total = 0.0;
+        for(int item = 0; item < weights.size(); ++item) {
+            assert(distribution.group(item) == groupOf[item]);
+            if(groupOf[item] == -1) continue;
+            assert(fabs(distribution[item] - weights[item]) < 1e-12);
+            groupSums[groupOf[item]] += weights[item];
+            ++groupSizes[groupOf[item]];
+            total += weights[item];
+        }
+        for(int g = 0; g < nGroups; ++g) {
+            assert(fabs(distribution.groupSum(g) - groupSums[g]) < 1e-9);
+            assert(distribution.itemsIn(g).size() == groupSizes[g]);
+            for(int item: distribution.itemsIn(g)) assert(groupOf[item] == g);
+        }
+        assert(fabs(distribution.sum() - total) < 1e-8);
+    }
+
+    // chi-squared test of a histogram of draws from all items, or from one group
+    void testHistogram(const std::vector<int> &histogram, int nSamples, int group) {
+        double total = group == -1 ? distribution.sum() : distribution.groupSum(group);
+        double chiSq = 0.0;
+        int nCategories = 0;
+        for(int item = 0; item < weights.size(); ++item) {
+            if(groupOf[item] == -1 || (group != -1 && groupOf[item] != group)) {
+                assert(histogram[item] == 0);
+                continue;
+            }
+            ++nCategories;
+            double expectedCount = weights[item] / total * nSamples;
+            double sampleError = histogram[item] - expectedCount;
+            chiSq += sampleError*sampleError / expectedCount;
+        }
+        assert(!pValueIsLessThan(chiSq, nCategories - 1, 0.0001));
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALGROUPS_H
@@ -0,0 +1,103 @@
+//
+// Tests of features specific to MutableCategorical
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALHANDLES_H
+#define CPP_TESTMUTABLECATEGORICALHANDLES_H
+
+#include <vector>
+#include "TestMutableCategorical.h"
+#include "../MutableCategorical.h"
+
+template<class DIST>
+class TestMutableCategoricalHandles: public TestMutableCategorical<DIST> {
+public:
+
+    void doTest() {
+        testStableHandles();
+        testStaleHandles();
+    }
+
+    // checks that iterators still refer to the same category after other categories
+    // have been erased and moved into the erased positions
+    void testStableHandles() {
+        this->reference.clear();
+        std::vector<typename DIST::iterator> handles;
+        for(int i=0; i < this->nInitCategories; ++i) {
+            double weight = std::uniform_real_distribution<double>()(this->randomSource);
+            this->reference[i] = weight;
+            handles.push_back(this->distribution.add(i, weight));
+        }
+        std::shuffle(handles.begin(), handles.end(), this->randomSource);
+        while(handles.size() > 0) {
+            this->reference.erase(*handles.back());
+            this->distribution.erase(handles.back());
+            handles.pop_back();
+            for(int i=0; i<10 && i<handles.size(); ++i) {
+                assert(this->distribution.isValid(handles[i]));
+                assert(fabs(this->distribution.weight(handles[i]) - this->reference[*handles[i]]) < 1e-8);
+            }
+        }
+        assert(this->distribution.size() == 0);
+        std::cout << "Successfully kept stable handles" << std::endl;
+    }
+
+    // checks that erased categories are detected even if their slots are reused
+    void testStaleHandles() {
+        auto first = this->distribution.add(1, 1.0);
+        auto second = this->distribution.add(2, 2.0);
+        this->distribution.erase(first);
+        assert(!this->distribution.isValid(first));
+        assert(this->distribution.isValid(second));
+        assert(*second == 2 && this->distribution.weight(second) == 2.0);
+        auto third = this->distribution.add(3, 3.0);  // reuses the slot of first
+        assert(!this->distribution.isValid(first));
+        assert(first != third);
+        assert(*third == 3 && this->distribution.sum() == 5.0);
+        this->distribution.erase(second);
+        this->distribution.erase(third);
+        std::cout << "Successfully detected stale handles" << std::endl;
+    }
+
+    // for distributions with a label index, checks lookup, modification and erasure by label
+    // against the reference
+    void testLabelIndex() {
+        this->reference.clear();
+        for(int i=0; i < this->nInitCategories; ++i) {
+            int label = 7 * i; // include collisions in the lower bits of the hash
+            double weight = std::uniform_real_distribution<double>()(this->randomSource);
+            this->reference[label] = weight;
+            this->distribution.set(label, weight);
+        }
+        assert(this->haveEqualEntries(this->reference, this->distribution));
+        std::uniform_int_distribution<int> randomLabel(0, 7 * this->nInitCategories);
+        for(int i=0; i < 10 * this->nInitCategories; ++i) {
+            int label = randomLabel(this->randomSource);
+            bool isInReference = this->reference.count(label) != 0;
+            assert(this->distribution.contains(label) == isInReference);
+            if(isInReference) {
+                assert(fabs(this->distribution.weight(label) - this->reference[label]) < 1e-8);
+                assert(*this->distribution.find(label) == label);
+                if(i % 2 == 0) {
+                    this->reference.erase(label);
+                    assert(this->distribution.erase(label) == 1);
+                    assert(!this->distribution.contains(label));
+                    continue;
+                }
+            } else {
+                assert(this->distribution.weight(label) == 0.0);
+                assert(this->distribution.erase(label) == 0);
+                assert(this->distribution.find(label) == this->distribution.end());
+            }
+            double weight = std::uniform_real_distribution<double>()(this->randomSource);
+            this->reference[label] = weight;
+            this->distribution.set(label, weight);
+        }
+        assert(this->haveEqualEntries(this->reference, this->distribution));
+        assert(this->randomDrawIsCorrect(this->distribution));
+        std::cout << "Successfully looked up categories by label" << std::endl;
+        this->testDeletion();
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALHANDLES_H
@@ -0,0 +1,113 @@
+//
+// Tests of the instrumentation policies and stats() of MutableCategoricalArray,
+// MutableCategorical and MutableCategoricalMap
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALINSTRUMENTATION_H
+#define CPP_TESTMUTABLECATEGORICALINSTRUMENTATION_H
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <vector>
+#include "../MutableCategoricalArray.h"
+#include "../MutableCategorical.h"
+#include "../MutableCategoricalMap.h"
+
+class TestMutableCategoricalInstrumentation {
+public:
+    std::mt19937 rng;
+
+    void doTest() {
+        testNoInstrumentation();
+        testArrayCounts();
+        testCategoricalCounts();
+        testMapCounts();
+    }
+
+    // the default policy adds nothing to the size of the classes and counts nothing
+    void testNoInstrumentation() {
+        struct UninstrumentedArray { std::vector<double> tree; int indexHighestBit; };
+        static_assert(sizeof(MutableCategoricalArray<>) == sizeof(UninstrumentedArray));
+        MutableCategoricalArray<> dist(1000, [](int i) { return 1.0; });
+        for(int i = 0; i < 100; ++i) dist.set(dist(rng), 2.0);
+        MutableCategoricalStats stats = dist.stats();
+        assert(stats.nSamples == 0 && stats.nUpdates == 0);
+        assert(stats.expectedDepth == 10.0);
+        assert(stats.memoryBytes >= 1000 * sizeof(double));
+        std::cout << "Passed no instrumentation test" << std::endl;
+    }
+
+    void testArrayCounts() {
+        // with a power of two size, every draw reads one node at each level
+        const int nLevels = 10;
+        MutableCategoricalArray<double, std::vector<double>, CountingInstrumentation> dist(1 << nLevels, [](int i) { return i + 1.0; });
+        for(int i = 0; i < 1000; ++i) dist(rng);
+        std::vector<int> samples;
+        dist.sample(rng, 100, std::back_inserter(samples));
+        dist.sampleDistinct(rng, 5, std::back_inserter(samples));
+        MutableCategoricalStats stats = dist.stats();
+        assert(stats.nSamples >= 1105);
+        assert(stats.sampleNodesVisited == stats.nSamples * nLevels);
+        assert(stats.meanSampleNodesVisited() == stats.expectedDepth);
+
+        // setting index 0 reads its 10 right children, setting the last index updates it and its 10 ancestors
+        dist.set(0, 1.0);
+        dist.set((1 << nLevels) - 1, 1.0);
+        stats = dist.stats();
+        assert(stats.nUpdates == 2);
+        assert(stats.updateNodesVisited == 2 * (nLevels + 1));
+        dist.setMany({1, 2}, {3.0, 4.0});
+        assert(dist.stats().nUpdates == 4);
+
+        auto copy = dist;
+        assert(copy.stats().nSamples == stats.nSamples);
+        std::cout << "Passed array instrumentation test" << std::endl;
+    }
+
+    void testCategoricalCounts() {
+        MutableCategorical<int, double, void, CountingInstrumentation> dist;
+        std::vector<MutableCategorical<int, double, void, CountingInstrumentation>::iterator> categories;
+        for(int i = 0; i < 100; ++i) categories.push_back(dist.add(i, 1.0));
+        for(int i = 0; i < 100; ++i) dist(rng);
+        dist.erase(categories.back()); // erasing the last category only pops it from the array
+        MutableCategoricalStats stats = dist.stats();
+        assert(stats.nSamples == 100);
+        assert(stats.nUpdates == 101);
+        assert(stats.memoryBytes >= 100 * (sizeof(int) + sizeof(double)));
+        std::cout << "Passed MutableCategorical instrumentation test" << std::endl;
+    }
+
+    void testMapCounts() {
+        std::exponential_distribution<double> exponential;
+        std::vector<std::pair<int,double>> entries;
+        for(int i = 0; i < 1000; ++i) entries.emplace_back(i, exponential(rng));
+
+        // a Huffman tree is optimal
+        MutableCategoricalMap<int, std::allocator<int>, false, CountingInstrumentation> huffman(entries.begin(), entries.end(), decltype(huffman)::HUFFMAN_TREE);
+        MutableCategoricalStats huffmanStats = huffman.stats();
+        assert(fabs(huffmanStats.expectedDepth - huffmanStats.huffmanDepth) < 1e-9);
+
+        // the mean number of nodes visited by draws is the expected depth
+        MutableCategoricalMap<int, std::allocator<int>, false, CountingInstrumentation> dist;
+        std::vector<decltype(dist)::iterator> categories;
+        for(const std::pair<int,double> &entry: entries) categories.push_back(dist.add(entry.first, entry.second));
+        const int nSamples = 100000;
+        for(int i = 0; i < nSamples; ++i) dist(rng);
+        MutableCategoricalStats stats = dist.stats();
+        assert(stats.nSamples == nSamples);
+        assert(fabs(stats.meanSampleNodesVisited() - stats.expectedDepth) < 0.05 * stats.expectedDepth);
+        assert(stats.huffmanDepth <= stats.expectedDepth + 1e-9);
+        assert(stats.nUpdates == entries.size());
+        assert(stats.memoryBytes >= entries.size() * sizeof(double));
+
+        dist.set(categories[0], 2.0);
+        dist.erase(categories[1]);
+        assert(dist.stats().nUpdates == entries.size() + 2);
+        std::cout << "Passed map instrumentation test" << std::endl;
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALINSTRUMENTATION_H
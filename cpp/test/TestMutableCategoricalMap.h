@@ -0,0 +1,120 @@
+//
+// Tests of features specific to MutableCategoricalMap and MutableCategoricalCompactMap
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALMAP_H
+#define CPP_TESTMUTABLECATEGORICALMAP_H
+
+#include <memory>
+#include <set>
+#include <vector>
+#include <utility>
+#include "TestMutableCategorical.h"
+#include "../MutableCategoricalMap.h"
+#include "../MutableCategoricalCompactMap.h"
+
+template<class MAP>
+class TestMutableCategoricalMap: public TestMutableCategorical<MAP> {
+public:
+
+    void doTest() {
+        testBulkCreation(MAP::BINARY_TREE);
+        testBulkCreation(MAP::HUFFMAN_TREE);
+        testChurn();
+    }
+
+    // builds a distribution in one go, then checks it can be modified and deleted as normal
+    void testBulkCreation(typename MAP::TreeType treeType) {
+        std::vector<std::pair<int,double>> entries;
+        this->reference.clear();
+        for(int i=0; i < this->nInitCategories; ++i) {
+            double weight = std::exponential_distribution<double>()(this->randomSource);
+            entries.emplace_back(i, weight);
+            this->reference[i] = weight;
+        }
+        this->distribution.clear();
+        if(treeType == MAP::HUFFMAN_TREE) {
+            this->distribution.createHuffmanTree(entries.begin(), entries.end());
+        } else {
+            this->distribution.createBinaryTree(entries.begin(), entries.end());
+        }
+        assert(this->haveEqualEntries(this->reference, this->distribution));
+        assert(this->randomDrawIsCorrect(this->distribution));
+
+        MAP constructed(entries.begin(), entries.begin() + 10, treeType);
+        assert(constructed.size() == 10);
+
+        std::cout << "Successfully created " << (treeType == MAP::HUFFMAN_TREE ? "Huffman" : "binary") << " tree" << std::endl;
+        this->testModification();
+        this->testDeletion();
+    }
+
+    // For MutableCategoricalMapWithRotation, modifications reorder the categories, but iteration
+    // between modifications visits every category once, and erasing a collected set of
+    // iterators erases exactly those categories.
+    void testRotationOrder() {
+        MAP map;
+        std::vector<typename MAP::iterator> categories;
+        for(int i=0; i < this->nInitCategories; ++i) {
+            categories.push_back(map.add(i, std::uniform_real_distribution<double>()(this->randomSource)));
+        }
+        for(auto it : categories) map.set(it, std::exponential_distribution<double>()(this->randomSource));
+        std::set<int> visited;
+        double cumulativeWeight = 0.0;
+        for(auto it = map.begin(); it != map.end(); ++it) {
+            visited.insert(*it);
+            assert(fabs(map.prefixSum(it) - cumulativeWeight) < 1e-9);
+            cumulativeWeight += map.weight(it);
+        }
+        assert(visited.size() == this->nInitCategories);
+
+        std::vector<typename MAP::iterator> evens;
+        for(auto it = map.begin(); it != map.end(); ++it) if(*it % 2 == 0) evens.push_back(it);
+        for(auto it : evens) map.erase(it);
+        assert(map.size() == this->nInitCategories / 2);
+        for(auto it = map.begin(); it != map.end(); ++it) assert(*it % 2 == 1);
+        std::cout << "Passed rotation order test" << std::endl;
+    }
+
+    // For MutableCategoricalCompactMap, erase() destroys the category's value straight away,
+    // rather than when its leaf is reused, and clear() destroys only the values still held.
+    void testValueDestruction() {
+        std::shared_ptr<int> value = std::make_shared<int>(0);
+        MutableCategoricalCompactMap<std::shared_ptr<int>> map;
+        std::vector<MutableCategoricalCompactMap<std::shared_ptr<int>>::iterator> categories;
+        for(int i=0; i < 100; ++i) categories.push_back(map.add(value, 1.0));
+        assert(value.use_count() == 101);
+        for(int i=0; i < 50; ++i) map.erase(categories[i]);
+        assert(value.use_count() == 51);
+        for(int i=0; i < 10; ++i) map.add(value, 1.0);
+        assert(value.use_count() == 61);
+        map.clear();
+        assert(value.use_count() == 1);
+        std::cout << "Passed value destruction test" << std::endl;
+    }
+
+    // erases and re-adds categories, so the nodes of erased categories are reused
+    void testChurn() {
+        std::vector<typename MAP::iterator> categories;
+        this->reference.clear();
+        for(int i=0; i < this->nInitCategories; ++i) {
+            double weight = std::uniform_real_distribution<double>()(this->randomSource);
+            categories.push_back(this->distribution.add(i, weight));
+            this->reference[i] = weight;
+        }
+        for(int op = 0; op < 10 * this->nInitCategories; ++op) {
+            int i = std::uniform_int_distribution<int>(0, this->nInitCategories - 1)(this->randomSource);
+            double weight = std::uniform_real_distribution<double>()(this->randomSource);
+            this->distribution.erase(categories[i]);
+            categories[i] = this->distribution.add(i, weight);
+            this->reference[i] = weight;
+        }
+        assert(this->haveEqualEntries(this->reference, this->distribution));
+        assert(this->randomDrawIsCorrect(this->distribution));
+        this->distribution.clear();
+        this->reference.clear();
+        std::cout << "Passed churn test" << std::endl;
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALMAP_H
@@ -0,0 +1,69 @@
+//
+// Tests of features specific to MutableCategoricalRangeArray
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALRANGEARRAY_H
+#define CPP_TESTMUTABLECATEGORICALRANGEARRAY_H
+
+#include <vector>
+#include <cmath>
+#include <utility>
+#include "TestMutableCategoricalArray.h"
+#include "../MutableCategoricalRangeArray.h"
+
+class TestMutableCategoricalRangeArray: public TestMutableCategoricalArray<MutableCategoricalRangeArray> {
+public:
+
+    void doTest() {
+        testRangeUpdates();
+    }
+
+    // range updates, interleaved with set() and push_back(), should give the same weights as
+    // updating a vector of weights one at a time, and draws should be correct while tags are pending
+    void testRangeUpdates() {
+        int N = 1000;
+        std::uniform_real_distribution<double> uniformDist(0.0,1.0);
+        std::uniform_int_distribution<int> indexDist(0, N);
+        std::vector<double> weights(N);
+        for(double &weight: weights) weight = uniformDist(rng);
+        MutableCategoricalRangeArray dist(weights.begin(), weights.end());
+        for(int op = 0; op < 2000; ++op) {
+            int begin = indexDist(rng);
+            int end = indexDist(rng);
+            if(begin > end) std::swap(begin, end);
+            if(op % 3 == 0) {
+                double delta = uniformDist(rng);
+                dist.addRange(begin, end, delta);
+                for(int i = begin; i < end; ++i) weights[i] += delta;
+            } else if(op % 3 == 1) {
+                double factor = 0.5 + uniformDist(rng);
+                dist.scaleRange(begin, end, factor);
+                for(int i = begin; i < end; ++i) weights[i] *= factor;
+            } else if(begin < N) {
+                weights[begin] = uniformDist(rng);
+                dist.set(begin, weights[begin]);
+            }
+            if(op % 100 == 0) {
+                double rangeSum = 0.0;
+                for(int i = begin; i < end; ++i) rangeSum += weights[i];
+                assert(fabs(dist.rangeSum(begin, end) - rangeSum) < 1e-9 * (1.0 + rangeSum));
+            }
+        }
+        for(int i = 0; i < N; ++i) assert(fabs(dist[i] - weights[i]) < 1e-9 * weights[i]);
+        testDistribution(dist, 1000000);
+
+        // zeroing a range should leave none of it to draw, and grow and shrink with tags pending
+        dist.scaleRange(0, N - 1, 0.0);
+        for(int s = 0; s < 1000; ++s) assert(dist(rng) == N - 1);
+        dist.addRange(N/2, N, 1.0);
+        for(int i = 0; i < N; ++i) dist.push_back(2.0);
+        dist.addRange(0, 2*N, 1.0);
+        assert(dist[0] == 1.0 && dist[N/2] == 2.0 && dist[2*N - 1] == 3.0);
+        while(dist.size() > static_cast<size_t>(N/2)) dist.pop_back();
+        assert(fabs(dist.sum() - N/2) < 1e-9);
+        testDistribution(dist, 100000);
+        std::cout << "Passed range update test" << std::endl;
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALRANGEARRAY_H
@@ -0,0 +1,46 @@
+//
+// Tests of features specific to MutableCategoricalRejectionArray
+//
+
+#ifndef CPP_TESTMUTABLECATEGORICALREJECTIONARRAY_H
+#define CPP_TESTMUTABLECATEGORICALREJECTIONARRAY_H
+
+#include <vector>
+#include <cmath>
+#include "TestMutableCategoricalArray.h"
+#include "../MutableCategoricalRejectionArray.h"
+
+class TestMutableCategoricalRejectionArray: public TestMutableCategoricalArray<MutableCategoricalRejectionArray> {
+public:
+
+    void doTest() {
+        testExtremeWeights();
+    }
+
+    // checks draws when no category has weight, when a weight is in the top group, whose bound
+    // would overflow, and when the weights span many powers of two
+    void testExtremeWeights() {
+        int drawn = drawAfterZeroing();
+        assert(drawn == -1);
+
+        MutableCategoricalRejectionArray huge{0.0, std::ldexp(1.5, 1023)};
+        for(int i=0; i<1000; ++i) {
+            drawn = huge(rng);
+            assert(drawn == 1);
+        }
+        std::vector<double> weights = {std::ldexp(1.0, 1022), std::ldexp(1.5, 1022), 1.0};
+        MutableCategoricalRejectionArray spread(weights.begin(), weights.end());
+        testDistribution(spread, weights, 100000);
+
+        // weights spanning many powers of two, so groups are spread over many buckets
+        std::vector<double> wide(2000);
+        for(size_t i=0; i<wide.size(); ++i) wide[i] = std::ldexp(1.0 + (i % 7) / 7.0, static_cast<int>(i % 41) - 20);
+        MutableCategoricalRejectionArray wideArray(wide.begin(), wide.end());
+        testDistribution(wideArray, wide, 1000000);
+        for(size_t i=0; i<wide.size(); i += 3) wideArray.set(i, wide[i] = std::ldexp(wide[i], 100));
+        testDistribution(wideArray, wide, 1000000);
+        std::cout << "Passed ExtremeWeights test" << std::endl;
+    }
+};
+
+#endif //CPP_TESTMUTABLECATEGORICALREJECTIONARRAY_H
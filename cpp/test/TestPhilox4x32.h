@@ -0,0 +1,94 @@
+//
+// Tests of the Philox4x32 counter-based generator
+//
+
+#ifndef CPP_TESTPHILOX4X32_H
+#define CPP_TESTPHILOX4X32_H
+
+#include <bitset>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+#include "../Philox4x32.h"
+
+class TestPhilox4x32 {
+public:
+
+    void doTest() {
+        testKnownAnswers();
+        testSeek();
+        testStreams();
+    }
+
+    // the known answer tests of the Random123 reference implementation
+    void testKnownAnswers() {
+        assert((Philox4x32::generate({0, 0, 0, 0}, {0, 0}) ==
+                Philox4x32::counter_type{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+        assert((Philox4x32::generate({0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff}) ==
+                Philox4x32::counter_type{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}));
+        assert((Philox4x32::generate({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0}) ==
+                Philox4x32::counter_type{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}));
+
+        // the outputs of a generator are the blocks of its counter, two words at a time
+        Philox4x32 generator;
+        assert(generator() == 0xe169c58d6627e8d5);
+        assert(generator() == 0x9b00dbd8bc57ac4c);
+        std::cout << "Passed Philox4x32 known answer test" << std::endl;
+    }
+
+    // seek() and discard() should give the same outputs as taking them one at a time
+    void testSeek() {
+        Philox4x32 generator(42, 7);
+        std::vector<uint64_t> outputs;
+        for(int i = 0; i < 101; ++i) outputs.push_back(generator());
+        for(uint64_t position: {0, 1, 2, 57, 100}) {
+            Philox4x32 seeker(42, 7);
+            seeker.seek(position);
+            assert(seeker() == outputs[position]);
+            assert(seeker.position() == position + 1);
+        }
+        Philox4x32 discarder(42, 7);
+        discarder();
+        discarder.discard(56);
+        assert(discarder() == outputs[57]);
+        discarder.seek(3);
+        assert(discarder() == outputs[3]);
+        assert(discarder != generator);
+        discarder.seek(101);
+        assert(discarder == generator);
+        std::cout << "Passed Philox4x32 seek test" << std::endl;
+    }
+
+    // different seeds and streams should give different outputs, which should be uniform
+    void testStreams() {
+        std::set<uint64_t> outputs;
+        for(uint64_t seed = 0; seed < 4; ++seed) {
+            for(uint64_t stream = 0; stream < 4; ++stream) {
+                Philox4x32 generator(seed, stream);
+                for(int i = 0; i < 100; ++i) outputs.insert(generator());
+            }
+        }
+        assert(outputs.size() == 1600);
+
+        Philox4x32 generator(99);
+        generator.setStream(3);
+        assert(generator.stream() == 3 && generator.position() == 0);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        const int nSamples = 1000000;
+        double mean = 0.0;
+        int ones = 0;
+        for(int i = 0; i < nSamples; ++i) {
+            mean += uniform(generator);
+            ones += std::bitset<64>(generator()).count();
+        }
+        mean /= nSamples;
+        assert(fabs(mean - 0.5) < 5.0 * sqrt(1.0/(12.0*nSamples)));
+        assert(fabs(ones - 32.0 * nSamples) < 5.0 * sqrt(16.0 * nSamples));
+        std::cout << "Passed Philox4x32 streams test" << std::endl;
+    }
+};
+
+#endif //CPP_TESTPHILOX4X32_H